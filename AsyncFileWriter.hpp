@@ -0,0 +1,281 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#ifndef TERRAIN_USE_IO_URING
+#define TERRAIN_USE_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef TERRAIN_USE_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//This class writes whole files without waiting for each one. On Linux the writes are queued to the kernel with io_uring and a
+//full queue is submitted with one system call, so one thread keeps many files being written at once. Where io_uring is not
+//there, or the kernel does not allow it, each file is written when it is queued.
+class AsyncFileWriter {
+
+private:
+
+	//Number of writes queued at once
+	unsigned int queueDepth;
+
+	bool failed;
+
+	//A file can belong to one writer only
+	AsyncFileWriter(const AsyncFileWriter&);
+	AsyncFileWriter& operator=(const AsyncFileWriter&);
+
+	//Write a file and wait for it
+	static bool writeNow(const std::string& fileName, const std::vector<unsigned char>& data) {
+
+		FILE* file = fopen(fileName.c_str(), "wb");
+		if (file == NULL) {
+			return false;
+		}
+		bool written = data.empty() || fwrite(data.data(), data.size(), 1, file) == 1;
+		written = fclose(file) == 0 && written;
+		if (!written) {
+			remove(fileName.c_str());
+		}
+		return written;
+	}
+
+#ifdef TERRAIN_USE_IO_URING
+
+	//A write the kernel has not finished. The data has to stay until it has.
+	struct PendingWrite {
+		int file;
+		std::string fileName;
+		std::shared_ptr<std::vector<unsigned char> > data;
+	};
+
+	int ring;
+
+	//Rings shared with the kernel
+	void* submissionRing;
+	void* completionRing;
+	io_uring_sqe* submissionEntries;
+	size_t submissionRingSize, completionRingSize, submissionEntriesSize;
+	unsigned int *submissionTail, *submissionMask, *submissionArray;
+	unsigned int *completionHead, *completionTail, *completionMask;
+	io_uring_cqe* completionEntries;
+
+	//Writes by slot, which is the user data of their queue entries, and the slots not in use
+	std::vector<PendingWrite> pendingWrites;
+	std::vector<unsigned int> freeSlots;
+	unsigned int unsubmittedWrites;
+
+	//Set up the rings. Returns false if io_uring cannot be used, and the files are then written when they are queued.
+	bool setUpRing() {
+
+		io_uring_params parameters;
+		std::memset(&parameters, 0, sizeof(parameters));
+		this->ring = (int)syscall(__NR_io_uring_setup, this->queueDepth, &parameters);
+		if (this->ring < 0) {
+			return false;
+		}
+
+		this->submissionRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned int);
+		this->completionRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+		this->submissionEntriesSize = parameters.sq_entries * sizeof(io_uring_sqe);
+		this->submissionRing = mmap(NULL, this->submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_SQ_RING);
+		this->completionRing = mmap(NULL, this->completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_CQ_RING);
+		void* entries = mmap(NULL, this->submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_SQES);
+		if (this->submissionRing == MAP_FAILED || this->completionRing == MAP_FAILED || entries == MAP_FAILED) {
+			this->submissionEntries = entries == MAP_FAILED ? NULL : (io_uring_sqe*)entries;
+			tearDownRing();
+			return false;
+		}
+
+		unsigned char* submissionBytes = (unsigned char*)this->submissionRing;
+		unsigned char* completionBytes = (unsigned char*)this->completionRing;
+		this->submissionTail = (unsigned int*)(submissionBytes + parameters.sq_off.tail);
+		this->submissionMask = (unsigned int*)(submissionBytes + parameters.sq_off.ring_mask);
+		this->submissionArray = (unsigned int*)(submissionBytes + parameters.sq_off.array);
+		this->submissionEntries = (io_uring_sqe*)entries;
+		this->completionHead = (unsigned int*)(completionBytes + parameters.cq_off.head);
+		this->completionTail = (unsigned int*)(completionBytes + parameters.cq_off.tail);
+		this->completionMask = (unsigned int*)(completionBytes + parameters.cq_off.ring_mask);
+		this->completionEntries = (io_uring_cqe*)(completionBytes + parameters.cq_off.cqes);
+
+		//There are no more writes in flight than submission entries, so neither ring can overflow
+		this->queueDepth = parameters.sq_entries;
+		this->pendingWrites.resize(this->queueDepth);
+		for (unsigned int slot = 0; slot < this->queueDepth; ++slot) {
+			this->freeSlots.push_back(this->queueDepth - 1 - slot);
+		}
+		return true;
+	}
+
+	void tearDownRing() {
+
+		if (this->submissionRing != NULL && this->submissionRing != MAP_FAILED) {
+			munmap(this->submissionRing, this->submissionRingSize);
+		}
+		if (this->completionRing != NULL && this->completionRing != MAP_FAILED) {
+			munmap(this->completionRing, this->completionRingSize);
+		}
+		if (this->submissionEntries != NULL) {
+			munmap(this->submissionEntries, this->submissionEntriesSize);
+		}
+		if (this->ring >= 0) {
+			close(this->ring);
+		}
+		this->ring = -1;
+		this->submissionRing = this->completionRing = NULL;
+		this->submissionEntries = NULL;
+	}
+
+	//Submit the queued writes and wait until at least the given number of writes have finished
+	void submitAndWait(unsigned int completionCount) {
+
+		while (this->unsubmittedWrites > 0 || completionCount > 0) {
+			int result = (int)syscall(__NR_io_uring_enter, this->ring, this->unsubmittedWrites, completionCount, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				this->failed = true;
+				return;
+			}
+			if (result > 0) {
+				this->unsubmittedWrites -= (unsigned int)result;
+			}
+			unsigned int completed = reapCompletions();
+			completionCount = completed >= completionCount ? 0 : completionCount - completed;
+		}
+	}
+
+	//Close the files whose writes have finished. Short writes are finished here, and a kernel without io_uring writes has
+	//them done here too. Returns the number of writes that finished.
+	unsigned int reapCompletions() {
+
+		unsigned int head = *this->completionHead, tail = __atomic_load_n(this->completionTail, __ATOMIC_ACQUIRE), completed = 0;
+		for (; head != tail; ++head, ++completed) {
+
+			const io_uring_cqe& completion = this->completionEntries[head & *this->completionMask];
+			PendingWrite& write = this->pendingWrites[(size_t)completion.user_data];
+			size_t written = completion.res < 0 ? 0 : (size_t)completion.res;
+			bool writeFailed = completion.res < 0 && completion.res != -EINVAL && completion.res != -EOPNOTSUPP;
+			while (!writeFailed && written < write.data->size()) {
+				ssize_t result = pwrite(write.file, write.data->data() + written, write.data->size() - written, written);
+				writeFailed = result <= 0;
+				written += result > 0 ? (size_t)result : 0;
+			}
+
+			writeFailed = close(write.file) != 0 || writeFailed;
+			if (writeFailed) {
+				remove(write.fileName.c_str());
+				this->failed = true;
+			}
+			write.data.reset();
+			this->freeSlots.push_back((unsigned int)completion.user_data);
+		}
+		__atomic_store_n(this->completionHead, head, __ATOMIC_RELEASE);
+		return completed;
+	}
+
+#endif
+
+public:
+
+	//Constructor
+	AsyncFileWriter(unsigned int queueDepth) {
+
+		this->queueDepth = queueDepth;
+		this->failed = false;
+#ifdef TERRAIN_USE_IO_URING
+		this->ring = -1;
+		this->submissionRing = this->completionRing = NULL;
+		this->submissionEntries = NULL;
+		this->unsubmittedWrites = 0;
+		setUpRing();
+#endif
+	}
+
+	~AsyncFileWriter() {
+		finish();
+#ifdef TERRAIN_USE_IO_URING
+		tearDownRing();
+#endif
+	}
+
+	//Queue a file to be written with the data, which is kept until it has been
+	void write(const std::string& fileName, const std::shared_ptr<std::vector<unsigned char> >& data) {
+
+#ifdef TERRAIN_USE_IO_URING
+		if (this->ring >= 0) {
+
+			//A full queue is submitted in one go while waiting for a slot
+			if (this->freeSlots.empty()) {
+				submitAndWait(1);
+			}
+			if (this->freeSlots.empty()) {
+				this->failed = true;
+				return;
+			}
+
+			int file = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (file < 0) {
+				this->failed = true;
+				return;
+			}
+			unsigned int slot = this->freeSlots.back();
+			this->freeSlots.pop_back();
+			PendingWrite& write = this->pendingWrites[slot];
+			write.file = file;
+			write.fileName = fileName;
+			write.data = data;
+
+			unsigned int tail = *this->submissionTail, index = tail & *this->submissionMask;
+			io_uring_sqe& entry = this->submissionEntries[index];
+			std::memset(&entry, 0, sizeof(io_uring_sqe));
+			entry.opcode = IORING_OP_WRITE;
+			entry.fd = file;
+			entry.addr = (unsigned long long)(size_t)data->data();
+			entry.len = (unsigned int)data->size();
+			entry.off = 0;
+			entry.user_data = slot;
+			this->submissionArray[index] = index;
+			__atomic_store_n(this->submissionTail, tail + 1, __ATOMIC_RELEASE);
+			++this->unsubmittedWrites;
+			return;
+		}
+#endif
+		if (!writeNow(fileName, *data)) {
+			this->failed = true;
+		}
+	}
+
+	//Wait for every queued file to be written. Returns false if any of them could not be.
+	bool finish() {
+
+#ifdef TERRAIN_USE_IO_URING
+		if (this->ring >= 0) {
+			submitAndWait(this->queueDepth - this->freeSlots.size());
+		}
+#endif
+		return !this->failed;
+	}
+
+	//Are the files written by io_uring, rather than one at a time
+	bool isAsynchronous() const {
+#ifdef TERRAIN_USE_IO_URING
+		return this->ring >= 0;
+#else
+		return false;
+#endif
+	}
+
+};
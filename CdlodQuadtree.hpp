@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "ChunkCuller.hpp"
+#include "HeightPyramid.hpp"
+
+//A terrain chunk selected for drawing. The chunk is drawn with one patch mesh whose grid step is 2^lodLevel heightmap cells.
+//If only one quarter of the chunk needs to be drawn then quadrant is 0 to 3, otherwise it is ALL_QUADRANTS.
+struct CdlodSelection {
+	unsigned int column, row, size, lodLevel, quadrant;
+};
+
+//This class splits a heightmap into chunks in a quadtree for continuous distance-dependent level of detail (CDLOD) rendering.
+//Every chunk is drawn with the same patch mesh. Chunks further from the camera are larger and so are drawn with a coarser grid.
+//Near the end of each level's distance range the vertices morph into the coarser grid so that neighboring chunks do not crack.
+class CdlodQuadtree {
+
+private:
+
+	//Node in the quadtree covering a square area of the heightmap
+	struct Node {
+		unsigned int column, row, size, lodLevel;
+		float minHeight, maxHeight;
+		int children[4];
+	};
+
+	//The morph to the next level starts at this fraction of the distance range of a level
+	const float MORPH_START_RATIO = 0.7;
+
+	//Visible chunks are split into this many blocks along each side when they are added to the horizon, so that ridges
+	//narrower than a chunk still hide what is behind them
+	const unsigned int OCCLUDER_BLOCKS = 4;
+
+	unsigned int terrainDimension, patchDimension, patchLevel, lodLevelCount;
+
+	std::vector<float> heightMap;
+	std::vector<Node> nodes;
+
+	//Chunk bounds come from the height pyramid level with blocks the size of a level 0 chunk
+	HeightPyramid heightPyramid;
+
+	//Distance from the camera up to which each level of detail is used
+	std::vector<float> lodRanges;
+
+	//Convert a heightmap row or column to the -1 to +1 model coordinate used by the viewer
+	float getModelCoordinate(unsigned int cell) {
+		return -1.0 + cell * 2.0 / this->terrainDimension;
+	}
+
+	//Build the node and its children and return its position in the node vector
+	int buildNode(unsigned int column, unsigned int row, unsigned int size, unsigned int lodLevel) {
+
+		Node node;
+		node.column = column;
+		node.row = row;
+		node.size = size;
+		node.lodLevel = lodLevel;
+
+		node.minHeight = this->heightPyramid.getMinHeight(this->patchLevel + lodLevel, row / size, column / size);
+		node.maxHeight = this->heightPyramid.getMaxHeight(this->patchLevel + lodLevel, row / size, column / size);
+
+		std::fill(node.children, node.children + 4, -1);
+		if (lodLevel > 0) {
+			unsigned int childSize = size / 2;
+			for (auto quadrant = 0; quadrant < 4; ++quadrant) {
+				node.children[quadrant] = buildNode(column + (quadrant % 2) * childSize, row + (quadrant / 2) * childSize, childSize, lodLevel - 1);
+			}
+		}
+
+		this->nodes.push_back(node);
+		return this->nodes.size() - 1;
+	}
+
+	//Get the bounding box of a square area of the heightmap in model coordinates
+	void getBounds(unsigned int column, unsigned int row, unsigned int size, float boxMin[3], float boxMax[3]) {
+
+		unsigned int level = 0;
+		while ((1u << level) < size) {
+			++level;
+		}
+		boxMin[0] = getModelCoordinate(column);
+		boxMin[1] = this->heightPyramid.getMinHeight(level, row / size, column / size);
+		boxMin[2] = getModelCoordinate(row);
+		boxMax[0] = getModelCoordinate(column + size);
+		boxMax[1] = this->heightPyramid.getMaxHeight(level, row / size, column / size);
+		boxMax[2] = getModelCoordinate(row + size);
+	}
+
+	//Remove the selected chunks that are hidden behind nearer chunks
+	void cullHiddenChunks(float eyeX, float eyeY, float eyeZ, std::vector<CdlodSelection>& selection, ChunkCuller& culler) {
+
+		//Sort the chunks front to back by the distance of their centers from the eye
+		std::vector<std::pair<float, unsigned int>> chunkDistances;
+		float boxMin[3], boxMax[3];
+		for (unsigned int chunkCounter = 0; chunkCounter < selection.size(); ++chunkCounter) {
+			getSelectionBounds(selection[chunkCounter], boxMin, boxMax);
+			float xDistance = (boxMin[0] + boxMax[0]) / 2.0 - eyeX, yDistance = (boxMin[1] + boxMax[1]) / 2.0 - eyeY, zDistance = (boxMin[2] + boxMax[2]) / 2.0 - eyeZ;
+			chunkDistances.push_back(std::make_pair(xDistance * xDistance + yDistance * yDistance + zDistance * zDistance, chunkCounter));
+		}
+		std::sort(chunkDistances.begin(), chunkDistances.end());
+
+		std::vector<CdlodSelection> visibleChunks;
+		for (unsigned int chunkCounter = 0; chunkCounter < chunkDistances.size(); ++chunkCounter) {
+			const CdlodSelection& chunk = selection[chunkDistances[chunkCounter].second];
+			getSelectionBounds(chunk, boxMin, boxMax);
+			if (culler.isBelowHorizon(boxMin, boxMax)) {
+				continue;
+			}
+			visibleChunks.push_back(chunk);
+
+			unsigned int chunkSize = chunk.quadrant == ALL_QUADRANTS ? chunk.size : chunk.size / 2;
+			unsigned int firstColumn = chunk.column + (chunk.quadrant == ALL_QUADRANTS ? 0 : (chunk.quadrant % 2) * chunkSize);
+			unsigned int firstRow = chunk.row + (chunk.quadrant == ALL_QUADRANTS ? 0 : (chunk.quadrant / 2) * chunkSize);
+			unsigned int blockSize = std::max(chunkSize / OCCLUDER_BLOCKS, 1u);
+			for (unsigned int row = firstRow; row < firstRow + chunkSize; row += blockSize) {
+				for (unsigned int column = firstColumn; column < firstColumn + chunkSize; column += blockSize) {
+					getBounds(column, row, blockSize, boxMin, boxMax);
+					culler.addToHorizon(boxMin, boxMax);
+				}
+			}
+		}
+		selection.swap(visibleChunks);
+	}
+
+	//Check if any part of the node is within the given distance of the camera
+	bool isInRange(const Node& node, float eyeX, float eyeY, float eyeZ, float range) {
+
+		float xDistance = std::max(std::max(getModelCoordinate(node.column) - eyeX, eyeX - getModelCoordinate(node.column + node.size)), 0.0f);
+		float yDistance = std::max(std::max(node.minHeight - eyeY, eyeY - node.maxHeight), 0.0f);
+		float zDistance = std::max(std::max(getModelCoordinate(node.row) - eyeZ, eyeZ - getModelCoordinate(node.row + node.size)), 0.0f);
+
+		return xDistance * xDistance + yDistance * yDistance + zDistance * zDistance <= range * range;
+	}
+
+	//Add the node to the selection
+	void addSelection(const Node& node, unsigned int quadrant, std::vector<CdlodSelection>& selection) {
+
+		CdlodSelection selectedNode;
+		selectedNode.column = node.column;
+		selectedNode.row = node.row;
+		selectedNode.size = node.size;
+		selectedNode.lodLevel = node.lodLevel;
+		selectedNode.quadrant = quadrant;
+		selection.push_back(selectedNode);
+	}
+
+	//Select the node or its children for drawing. Returns false if the node is out of its range so that its parent should draw the area.
+	bool selectNode(int nodeIndex, float eyeX, float eyeY, float eyeZ, std::vector<CdlodSelection>& selection, ChunkCuller* culler) {
+
+		const Node& node = this->nodes[nodeIndex];
+
+		//Nothing needs to be drawn for a node outside the view frustum
+		if (culler != NULL) {
+			float boxMin[3], boxMax[3];
+			getBounds(node.column, node.row, node.size, boxMin, boxMax);
+			if (!culler->isInFrustum(boxMin, boxMax)) {
+				return true;
+			}
+		}
+
+		if (!isInRange(node, eyeX, eyeY, eyeZ, this->lodRanges[node.lodLevel])) {
+			return false;
+		}
+
+		//Draw the whole node if no part of it needs a finer level
+		if (node.lodLevel == 0 || !isInRange(node, eyeX, eyeY, eyeZ, this->lodRanges[node.lodLevel - 1])) {
+			addSelection(node, ALL_QUADRANTS, selection);
+			return true;
+		}
+
+		//Let the children draw themselves and draw the quadrants of the ones that are too far at this level
+		for (unsigned int quadrant = 0; quadrant < 4; ++quadrant) {
+			if (!selectNode(node.children[quadrant], eyeX, eyeY, eyeZ, selection, culler)) {
+				addSelection(node, quadrant, selection);
+			}
+		}
+		return true;
+	}
+
+public:
+
+	static const unsigned int ALL_QUADRANTS = 4;
+
+	//Constructor. The patch dimension is the number of grid cells along each side of the patch mesh. The distance ratio is the
+	//distance range of each level as a multiple of the size of its nodes.
+	CdlodQuadtree(unsigned int dimension, const std::vector<float>& heightMap, const HeightPyramid& heightPyramid, unsigned int patchDimension = 32, float lodDistanceRatio = 8.0) {
+
+		//The dimension should be a power of 2 plus 1
+		if (dimension < 3 || ((dimension - 1) & (dimension - 2)) != 0 || heightMap.size() != dimension * dimension) {
+			throw std::invalid_argument("Terrain dimension must be a power of 2 plus 1.");
+		}
+
+		this->terrainDimension = dimension;
+		this->heightMap = heightMap;
+		this->heightPyramid = heightPyramid;
+		this->patchDimension = std::min(patchDimension, dimension - 1);
+
+		this->patchLevel = 0;
+		while ((1u << this->patchLevel) < this->patchDimension) {
+			++this->patchLevel;
+		}
+
+		//Each level up doubles the node size until one node covers the terrain
+		this->lodLevelCount = 1;
+		while (this->patchDimension << (this->lodLevelCount - 1) < dimension - 1) {
+			++this->lodLevelCount;
+		}
+
+		for (unsigned int lodLevel = 0; lodLevel < this->lodLevelCount; ++lodLevel) {
+			this->lodRanges.push_back(lodDistanceRatio * (this->patchDimension << lodLevel) * 2.0 / dimension);
+		}
+		this->lodRanges.back() = std::numeric_limits<float>::max();
+
+		buildNode(0, 0, dimension - 1, this->lodLevelCount - 1);
+	}
+
+	//Select the chunks to be drawn for a camera at the given model coordinates. If a culler is given, chunks outside its view frustum
+	//are left out, and so are chunks hidden behind nearer chunks when the camera is above the terrain.
+	void selectNodes(float eyeX, float eyeY, float eyeZ, std::vector<CdlodSelection>& selection, ChunkCuller* culler = NULL) {
+
+		selection.clear();
+		selectNode(this->nodes.size() - 1, eyeX, eyeY, eyeZ, selection, culler);
+
+		if (culler != NULL && culler->isUpright() && eyeY > this->heightPyramid.getMaxHeight()) {
+			cullHiddenChunks(eyeX, eyeY, eyeZ, selection, *culler);
+		}
+	}
+
+	//Get the bounding box of a selected chunk in model coordinates
+	void getSelectionBounds(const CdlodSelection& chunk, float boxMin[3], float boxMax[3]) {
+
+		if (chunk.quadrant == ALL_QUADRANTS) {
+			getBounds(chunk.column, chunk.row, chunk.size, boxMin, boxMax);
+		}
+		else {
+			unsigned int quadrantSize = chunk.size / 2;
+			getBounds(chunk.column + (chunk.quadrant % 2) * quadrantSize, chunk.row + (chunk.quadrant / 2) * quadrantSize, quadrantSize, boxMin, boxMax);
+		}
+	}
+
+	//Get the distance from the camera where vertices start morphing into the next coarser level
+	float getMorphStart(unsigned int lodLevel) {
+		return this->lodRanges.at(lodLevel) * MORPH_START_RATIO;
+	}
+
+	//Get the distance from the camera where vertices have fully morphed into the next coarser level
+	float getMorphEnd(unsigned int lodLevel) {
+		return this->lodRanges.at(lodLevel);
+	}
+
+	unsigned int getPatchDimension() {
+		return this->patchDimension;
+	}
+
+	unsigned int getLodLevelCount() {
+		return this->lodLevelCount;
+	}
+
+	unsigned int getTerrainDimension() {
+		return this->terrainDimension;
+	}
+
+	//Return the heightmap the quadtree was built from
+	const std::vector<float>& getHeightMap() {
+		return this->heightMap;
+	}
+
+};
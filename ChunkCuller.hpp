@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+//This class decides which terrain chunks can be skipped. A chunk is skipped if its bounding box is outside the view frustum, or if
+//it is hidden behind chunks nearer to the camera. Hidden chunks are found with a horizon: for every column of the screen it keeps
+//the highest point covered by the chunks already drawn. Chunks must be given front to back, and the horizon only works when the
+//camera is above the terrain and the terrain is upright on the screen.
+class ChunkCuller {
+
+private:
+
+	//Number of screen columns the horizon is kept for
+	const unsigned int HORIZON_RESOLUTION = 1024;
+
+	//Model to clip space transform, one row after the other
+	float viewTransform[16];
+
+	//Planes of the view frustum in model coordinates. A point is inside if a * x + b * y + c * z + d >= 0 for all planes.
+	float frustumPlanes[6][4];
+
+	//Highest covered clip space y for each screen column
+	std::vector<float> horizon;
+
+	bool upright;
+
+	//Transform a model point to clip space and divide by w. Returns false if the point is behind the camera.
+	bool project(float x, float y, float z, float& screenX, float& screenY) {
+
+		const float* m = this->viewTransform;
+		float w = m[12] * x + m[13] * y + m[14] * z + m[15];
+		if (w <= 0.0) {
+			return false;
+		}
+		screenX = (m[0] * x + m[1] * y + m[2] * z + m[3]) / w;
+		screenY = (m[4] * x + m[5] * y + m[6] * z + m[7]) / w;
+		return true;
+	}
+
+	//Get the horizon column containing a clip space x
+	int getHorizonColumn(float screenX) {
+		return (int)std::floor((screenX + 1.0) / 2.0 * HORIZON_RESOLUTION);
+	}
+
+	//Get the clip space x of the center of a horizon column
+	float getHorizonColumnCenter(int column) {
+		return (column + 0.5) * 2.0 / HORIZON_RESOLUTION - 1.0;
+	}
+
+	//Find the top of a convex polygon at a clip space x. Returns false if the polygon does not reach this x.
+	bool getPolygonTop(const std::vector<float>& xs, const std::vector<float>& ys, float screenX, float& top) {
+
+		bool found = false;
+		for (unsigned int corner = 0; corner < xs.size(); ++corner) {
+			unsigned int next = (corner + 1) % xs.size();
+			float x1 = xs[corner], y1 = ys[corner], x2 = xs[next], y2 = ys[next];
+			if (screenX < std::min(x1, x2) || screenX > std::max(x1, x2)) {
+				continue;
+			}
+			float y = x1 == x2 ? std::max(y1, y2) : y1 + (y2 - y1) * (screenX - x1) / (x2 - x1);
+			top = found ? std::max(top, y) : y;
+			found = true;
+		}
+		return found;
+	}
+
+public:
+
+	//Constructor
+	ChunkCuller() {
+		this->horizon = std::vector<float>(HORIZON_RESOLUTION, -std::numeric_limits<float>::max());
+		this->upright = false;
+		std::fill(this->viewTransform, this->viewTransform + 16, 0.0f);
+	}
+
+	//Set the model to clip space transform for the frame and clear the horizon. The transform is given one row after the other.
+	void setViewTransform(const float transform[16]) {
+
+		std::copy(transform, transform + 16, this->viewTransform);
+
+		//Each frustum plane is the last row of the transform plus or minus one of the other rows
+		for (unsigned int plane = 0; plane < 6; ++plane) {
+			float sign = plane % 2 == 0 ? 1.0 : -1.0;
+			unsigned int row = plane / 2;
+			for (unsigned int column = 0; column < 4; ++column) {
+				this->frustumPlanes[plane][column] = transform[12 + column] + sign * transform[row * 4 + column];
+			}
+		}
+
+		//The horizon assumes that up on the terrain is close to up on the screen
+		float upX = transform[1], upY = transform[5];
+		this->upright = upY > 0.0 && std::abs(upX) < 0.25 * upY;
+
+		std::fill(this->horizon.begin(), this->horizon.end(), -std::numeric_limits<float>::max());
+	}
+
+	//Can the horizon be used for the current view
+	bool isUpright() {
+		return this->upright;
+	}
+
+	//Check if any part of the box is inside the view frustum
+	bool isInFrustum(const float boxMin[3], const float boxMax[3]) {
+
+		for (unsigned int plane = 0; plane < 6; ++plane) {
+			const float* p = this->frustumPlanes[plane];
+			//Use the corner of the box furthest along the plane normal
+			float x = p[0] >= 0.0 ? boxMax[0] : boxMin[0];
+			float y = p[1] >= 0.0 ? boxMax[1] : boxMin[1];
+			float z = p[2] >= 0.0 ? boxMax[2] : boxMin[2];
+			if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0.0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//Check if the box is below the horizon across its whole width on the screen
+	bool isBelowHorizon(const float boxMin[3], const float boxMax[3]) {
+
+		float left = std::numeric_limits<float>::max(), right = -left, top = -left, screenX, screenY;
+		for (unsigned int corner = 0; corner < 8; ++corner) {
+			if (!project(corner & 1 ? boxMax[0] : boxMin[0], corner & 2 ? boxMax[1] : boxMin[1], corner & 4 ? boxMax[2] : boxMin[2], screenX, screenY)) {
+				return false;
+			}
+			left = std::min(left, screenX);
+			right = std::max(right, screenX);
+			top = std::max(top, screenY);
+		}
+
+		int firstColumn = std::max(getHorizonColumn(left), 0), lastColumn = std::min(getHorizonColumn(right), (int)HORIZON_RESOLUTION - 1);
+		for (int column = firstColumn; column <= lastColumn; ++column) {
+			if (this->horizon[column] < top) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//Raise the horizon to cover the chunk. The terrain in the chunk is at least as high as the bottom of its box everywhere,
+	//so the bottom face of the box is used as the part of the screen that the chunk surely covers.
+	void addToHorizon(const float boxMin[3], const float boxMax[3]) {
+
+		std::vector<float> xs(4), ys(4);
+		float corners[4][2] = { { boxMin[0], boxMin[2] }, { boxMax[0], boxMin[2] }, { boxMax[0], boxMax[2] }, { boxMin[0], boxMax[2] } };
+		for (unsigned int corner = 0; corner < 4; ++corner) {
+			if (!project(corners[corner][0], boxMin[1], corners[corner][1], xs[corner], ys[corner])) {
+				return;
+			}
+		}
+
+		//Raise the columns whose centers are covered by the face to the top of the face. Sampling at the centers lets
+		//neighboring chunks that share an edge cover every column between them.
+		float left = *std::min_element(xs.begin(), xs.end()), right = *std::max_element(xs.begin(), xs.end());
+		int firstColumn = std::max(getHorizonColumn(left), 0), lastColumn = std::min(getHorizonColumn(right), (int)HORIZON_RESOLUTION - 1);
+		for (int column = firstColumn; column <= lastColumn; ++column) {
+			float top;
+			if (getPolygonTop(xs, ys, getHorizonColumnCenter(column), top)) {
+				this->horizon[column] = std::max(this->horizon[column], top);
+			}
+		}
+	}
+
+};
@@ -0,0 +1,132 @@
+#define _CRT_SECURE_NO_DEPRECATE
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "HeightMapCodec.hpp"
+#include "TerrainFactory.hpp"
+
+//Checks that heightmaps come back from HeightMapCodec as they should for every generator. Lossless data must decode to the
+//same bits, every coarser level must hold the heights of the whole heightmap it stands for, and lossy data must stay within
+//its maximum error. Like TerrainBatch it builds without OpenGL. It returns a failure status if any check fails.
+
+const char* const TerrainTypes[] = { "deposition", "rolldown", "squarediamond", "stepfault", "bump" };
+const float MaxErrors[] = { 0.05f, 0.001f, 1e-5f, 1e-7f };
+
+unsigned int failedChecks = 0;
+
+//Report a check that failed
+void fail(const std::string& terrainName, const std::string& problem)
+{
+	std::cout << terrainName << ": " << problem << std::endl;
+	++failedChecks;
+}
+
+//Find the largest difference between the heights of a decoded level and the heights it stands for, which are every
+//2^k th height of the original
+double getLevelError(const TiledHeightMap& original, const TiledHeightMap& level)
+{
+	unsigned int spacing = (original.getDimension() - 1) / (level.getDimension() - 1);
+	double maxDifference = 0.0;
+	for (unsigned int row = 0; row < level.getDimension(); ++row) {
+		for (unsigned int column = 0; column < level.getDimension(); ++column) {
+			double difference = std::fabs((double)level.get(row, column) - (double)original.get(row * spacing, column * spacing));
+			maxDifference = std::max(maxDifference, difference);
+		}
+	}
+	return maxDifference;
+}
+
+//Are two heightmaps the same bit for bit
+bool isBitExact(const TiledHeightMap& original, const TiledHeightMap& decoded)
+{
+	std::vector<float> originalHeights, decodedHeights;
+	original.toVector(originalHeights);
+	decoded.toVector(decodedHeights);
+	return originalHeights.size() == decodedHeights.size() &&
+		std::memcmp(originalHeights.data(), decodedHeights.data(), originalHeights.size() * sizeof(float)) == 0;
+}
+
+//Decode every level of coded data and check that each is within the maximum error of the original
+void checkLevels(const std::string& terrainName, const TiledHeightMap& original, const std::vector<unsigned char>& encoded, double maxError)
+{
+	int levelCount = HeightMapCodec::getLevelCount(encoded.data(), encoded.size());
+	if (levelCount < 0 || (1u << levelCount) + 1 != original.getDimension()) {
+		fail(terrainName, "wrong level count");
+		return;
+	}
+
+	for (int level = 0; level <= levelCount; ++level) {
+		TiledHeightMap decoded;
+		if (!HeightMapCodec::decode(encoded.data(), encoded.size(), level, decoded) || decoded.getDimension() != (1u << level) + 1) {
+			fail(terrainName, "cannot decode level " + std::to_string(level));
+		}
+		else if (getLevelError(original, decoded) > maxError) {
+			std::stringstream problem;
+			problem << "level " << level << " is off by " << getLevelError(original, decoded);
+			fail(terrainName, problem.str());
+		}
+	}
+}
+
+//Code a terrain losslessly and at each of the maximum errors and check what comes back
+void checkTerrain(const std::string& typeName, unsigned int dimension, unsigned int seed)
+{
+	std::stringstream nameStream;
+	nameStream << typeName << " " << dimension << " seed " << seed;
+	std::string terrainName = nameStream.str();
+	std::shared_ptr<Terrain> terrain = TerrainFactory::create(typeName, dimension, seed, 'c');
+	const TiledHeightMap& original = terrain->getHeightMap();
+
+	//Lossless data gives back the same bits, and each level the same heights
+	std::vector<unsigned char> encoded;
+	HeightMapCodec::encode(original, 0.0, encoded);
+	TiledHeightMap decoded;
+	if (!HeightMapCodec::decode(encoded.data(), encoded.size(), decoded) || !isBitExact(original, decoded)) {
+		fail(terrainName, "lossless heights are not bit exact");
+	}
+	checkLevels(terrainName, original, encoded, 0.0);
+
+	//Lossy data stays within the maximum error at every level. A maximum error too small for floats must be turned down.
+	for (unsigned int errorCounter = 0; errorCounter < sizeof(MaxErrors) / sizeof(MaxErrors[0]); ++errorCounter) {
+		try {
+			HeightMapCodec::encode(original, MaxErrors[errorCounter], encoded);
+		}
+		catch (const std::invalid_argument&) {
+			continue;
+		}
+		std::stringstream lossyName;
+		lossyName << terrainName << " error " << MaxErrors[errorCounter];
+		checkLevels(lossyName.str(), original, encoded, MaxErrors[errorCounter]);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int dimension = argc > 1 ? (unsigned int)std::strtoul(argv[1], NULL, 10) : 257;
+	try {
+		for (unsigned int typeCounter = 0; typeCounter < sizeof(TerrainTypes) / sizeof(TerrainTypes[0]); ++typeCounter) {
+			for (unsigned int seed = 0; seed < 3; ++seed) {
+				checkTerrain(TerrainTypes[typeCounter], dimension, seed);
+			}
+		}
+	}
+	catch (const std::exception& exception) {
+		std::cout << exception.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (failedChecks > 0) {
+		std::cout << failedChecks << " checks failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "Every heightmap came back as it should" << std::endl;
+	return EXIT_SUCCESS;
+}
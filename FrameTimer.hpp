@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+//This class records how long the CPU spends on each frame. The times of the most recent frames are kept so that their average
+//and worst case can be reported.
+class FrameTimer {
+
+private:
+
+	//Number of frames whose times are kept
+	static const unsigned int FRAME_COUNT = 120;
+
+	//Frame times in milliseconds, overwritten oldest first once full
+	std::vector<float> frameTimes;
+	unsigned int nextFrame, recordedFrames;
+
+	std::chrono::high_resolution_clock::time_point frameStart;
+
+public:
+
+	//Constructor
+	FrameTimer() : frameTimes(FRAME_COUNT, 0.0) {
+		this->nextFrame = 0;
+		this->recordedFrames = 0;
+	}
+
+	//Call when the frame starts
+	void startFrame() {
+		this->frameStart = std::chrono::high_resolution_clock::now();
+	}
+
+	//Call when the CPU work for the frame is done. Returns the time of the frame in milliseconds.
+	float endFrame() {
+
+		float frameTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - this->frameStart).count();
+		this->frameTimes[this->nextFrame] = frameTime;
+		this->nextFrame = (this->nextFrame + 1) % FRAME_COUNT;
+		++this->recordedFrames;
+		return frameTime;
+	}
+
+	//Get the number of frames drawn so far
+	unsigned int getRecordedFrames() {
+		return this->recordedFrames;
+	}
+
+	//Get the average time of the recent frames in milliseconds
+	float getAverageFrameTime() {
+
+		unsigned int frameCount = std::min(this->recordedFrames, (unsigned int)FRAME_COUNT);
+		if (frameCount == 0) {
+			return 0.0;
+		}
+
+		float totalTime = 0.0;
+		for (unsigned int frameCounter = 0; frameCounter < frameCount; ++frameCounter) {
+			totalTime += this->frameTimes[frameCounter];
+		}
+		return totalTime / frameCount;
+	}
+
+	//Get the longest time of the recent frames in milliseconds
+	float getMaxFrameTime() {
+
+		unsigned int frameCount = std::min(this->recordedFrames, (unsigned int)FRAME_COUNT);
+		return frameCount == 0 ? 0.0 : *std::max_element(this->frameTimes.begin(), this->frameTimes.begin() + frameCount);
+	}
+
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+//Receives the heights of a heightmap a band of rows at a time, from the first row to the last, so that a heightmap can be
+//written out as it is made without ever being held whole. Bands may have any number of rows.
+class HeightBandSink {
+
+public:
+
+	virtual ~HeightBandSink() {
+	}
+
+	//Take the next band of rows, which hold their heights one row after the other. Returns false if the heights could not be
+	//used, which stops the stream.
+	virtual bool takeBand(unsigned int firstRow, unsigned int rowCount, const float* heights) = 0;
+
+	//Called after the last band. Returns false if anything could not be written.
+	virtual bool finish() = 0;
+
+};
@@ -0,0 +1,594 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MappedFile.hpp"
+#include "TiledHeightMap.hpp"
+
+//This class compresses heightmaps for archiving. A heightmap of 2^n + 1 heights a side is coded the way SquareDiamondTerrain
+//builds one: the four corners first, then for each level the centers of the squares predicted from their corners and the
+//midpoints of the edges predicted from their neighbors. Only the differences from the predictions are stored, and these are
+//small wherever the terrain is smooth. They are entropy coded with adaptive Golomb-Rice codes.
+//
+//Lossless coding codes the bits of the heights exactly. Lossy coding rounds each height to a multiple of a step before it is
+//predicted from. The step is twice the maximum error less room for rounding the multiple to a float, so no height is off by
+//more than the maximum error.
+//
+//The heights of a level only depend on coarser levels, so each level is split into bands of rows coded as separate streams on
+//separate threads. The coarse levels come first, so decoding can stop after any level and give a smaller heightmap.
+class HeightMapCodec {
+
+private:
+
+	//Changed whenever the layout of the coded data changes
+	static const unsigned int FORMAT_VERSION = 2;
+
+	//Most heights coded in one stream, which is the work one thread does at a time
+	static const unsigned int HEIGHTS_PER_STREAM = 65536;
+
+	//Longest unary part of a Golomb-Rice code. Larger values are written out in full after it.
+	static const unsigned int ESCAPE_LENGTH = 24;
+
+	//Start of the coded data. The length in bytes of every stream follows it, then the streams one after the other.
+	struct Header {
+		char magic[4];
+		unsigned int version, dimension, levelCount, lossy;
+		float maxError;
+		unsigned long long streamCount;
+		double step;
+	};
+
+	//Half of the heights of a level. The diamond pass codes the centers of the squares of the level and the square pass codes
+	//the midpoints of their edges.
+	struct Pass {
+		unsigned int spacing, half;
+		bool diamond;
+	};
+
+	//Turns heights into whole numbers and back. Lossless codes are the bits of the height ordered so that they grow with the
+	//height. Lossy codes count steps.
+	struct SampleCoder {
+
+		bool lossy;
+		double step;
+
+		long long toCode(float height) const {
+
+			if (this->lossy) {
+				return std::llround(height / this->step);
+			}
+			unsigned int bits;
+			std::memcpy(&bits, &height, sizeof(float));
+			return (bits & 0x80000000u) != 0 ? ~bits : bits | 0x80000000u;
+		}
+
+		float fromCode(long long code) const {
+
+			if (this->lossy) {
+				return (float)(code * this->step);
+			}
+			unsigned int bits = (unsigned int)code;
+			bits = (bits & 0x80000000u) != 0 ? bits & 0x7FFFFFFFu : ~bits;
+			float height;
+			std::memcpy(&height, &bits, sizeof(float));
+			return height;
+		}
+	};
+
+	//Adaptive Golomb-Rice parameter, from the running average of the values coded so far
+	struct RiceParameter {
+
+		unsigned long long total;
+		unsigned int count;
+
+		RiceParameter() {
+			this->total = 4;
+			this->count = 1;
+		}
+
+		unsigned int get() const {
+			unsigned int parameter = 0;
+			while (((unsigned long long)this->count << parameter) < this->total && parameter < 62) {
+				++parameter;
+			}
+			return parameter;
+		}
+
+		//Older values count for less, so the parameter follows the terrain as it changes
+		void update(unsigned long long value) {
+			this->total += value;
+			if (++this->count == 64) {
+				this->total >>= 1;
+				this->count >>= 1;
+			}
+		}
+	};
+
+	//Writes bits into bytes, lowest bit first
+	class BitWriter {
+
+	private:
+
+		std::vector<unsigned char>& bytes;
+		unsigned long long buffer;
+		unsigned int bitCount;
+
+	public:
+
+		BitWriter(std::vector<unsigned char>& bytes) : bytes(bytes) {
+			this->buffer = 0;
+			this->bitCount = 0;
+		}
+
+		void write(unsigned long long value, unsigned int count) {
+
+			//At most 32 bits go in at a time, so the buffer never holds more than 39
+			while (count > 0) {
+				unsigned int chunk = std::min(count, 32u);
+				this->buffer |= (value & ((1ULL << chunk) - 1)) << this->bitCount;
+				this->bitCount += chunk;
+				value = chunk < 64 ? value >> chunk : 0;
+				count -= chunk;
+				while (this->bitCount >= 8) {
+					this->bytes.push_back((unsigned char)this->buffer);
+					this->buffer >>= 8;
+					this->bitCount -= 8;
+				}
+			}
+		}
+
+		void writeRice(unsigned long long value, unsigned int parameter) {
+
+			unsigned long long quotient = value >> parameter;
+			if (quotient < ESCAPE_LENGTH) {
+				write((1ULL << quotient) - 1, (unsigned int)quotient + 1);
+				write(value, parameter);
+			}
+			else {
+				unsigned int bitLength = 1;
+				while (bitLength < 64 && (value >> bitLength) != 0) {
+					++bitLength;
+				}
+				write((1ULL << ESCAPE_LENGTH) - 1, ESCAPE_LENGTH);
+				write(bitLength - 1, 6);
+				write(value, bitLength);
+			}
+		}
+
+		//Write the bits left over in a last byte
+		void flush() {
+			if (this->bitCount > 0) {
+				this->bytes.push_back((unsigned char)this->buffer);
+			}
+			this->buffer = 0;
+			this->bitCount = 0;
+		}
+	};
+
+	//Reads bits written by BitWriter. Reading past the end gives zeros and marks the data as damaged.
+	class BitReader {
+
+	private:
+
+		const unsigned char* bytes;
+		size_t size, position;
+		unsigned long long buffer;
+		unsigned int bitCount;
+		bool overrun;
+
+	public:
+
+		BitReader(const unsigned char* bytes, size_t size) {
+			this->bytes = bytes;
+			this->size = size;
+			this->position = 0;
+			this->buffer = 0;
+			this->bitCount = 0;
+			this->overrun = false;
+		}
+
+		unsigned long long read(unsigned int count) {
+
+			unsigned long long value = 0;
+			for (unsigned int readBits = 0; readBits < count;) {
+				unsigned int chunk = std::min(count - readBits, 32u);
+				while (this->bitCount < chunk) {
+					if (this->position < this->size) {
+						this->buffer |= (unsigned long long)this->bytes[this->position++] << this->bitCount;
+					}
+					else {
+						this->overrun = true;
+					}
+					this->bitCount += 8;
+				}
+				value |= (this->buffer & ((1ULL << chunk) - 1)) << readBits;
+				this->buffer >>= chunk;
+				this->bitCount -= chunk;
+				readBits += chunk;
+			}
+			return value;
+		}
+
+		unsigned long long readRice(unsigned int parameter) {
+
+			unsigned int quotient = 0;
+			while (quotient < ESCAPE_LENGTH && read(1) == 1) {
+				++quotient;
+			}
+			if (quotient < ESCAPE_LENGTH) {
+				return ((unsigned long long)quotient << parameter) | read(parameter);
+			}
+			return read((unsigned int)read(6) + 1);
+		}
+
+		bool isOverrun() const {
+			return this->overrun;
+		}
+	};
+
+	//Get the passes of the levels, coarsest first
+	static std::vector<Pass> getPasses(unsigned int dimension, unsigned int levelCount) {
+
+		std::vector<Pass> passes;
+		for (unsigned int level = 0; level < levelCount; ++level) {
+			unsigned int spacing = (dimension - 1) >> level;
+			Pass diamondPass = { spacing, spacing / 2, true }, squarePass = { spacing, spacing / 2, false };
+			passes.push_back(diamondPass);
+			passes.push_back(squarePass);
+		}
+		return passes;
+	}
+
+	//Rows of heights in a pass
+	static unsigned int getPassRowCount(unsigned int dimension, const Pass& pass) {
+		return pass.diamond ? (dimension - 1) / pass.spacing : (dimension - 1) / pass.half + 1;
+	}
+
+	//Rows of a pass coded in each stream. A pass has about as many heights in a row at every dimension, so a level is split
+	//into the same streams whether it is decoded on its own or as part of a finer heightmap.
+	static unsigned int getRowsPerStream(unsigned int dimension, const Pass& pass) {
+		return std::max(HEIGHTS_PER_STREAM / ((dimension - 1) / pass.spacing + 1), 1u);
+	}
+
+	static unsigned int getStreamCount(unsigned int dimension, const Pass& pass) {
+		unsigned int rowsPerStream = getRowsPerStream(dimension, pass);
+		return (getPassRowCount(dimension, pass) + rowsPerStream - 1) / rowsPerStream;
+	}
+
+	//Call a function with the row and column of every height a stream of a pass codes, in order
+	template <class Visitor>
+	static void visitStream(unsigned int dimension, const Pass& pass, unsigned int stream, Visitor visit) {
+
+		unsigned int rowsPerStream = getRowsPerStream(dimension, pass), rowCount = getPassRowCount(dimension, pass);
+		unsigned int firstRow = pass.diamond ? pass.half : 0, rowStep = pass.diamond ? pass.spacing : pass.half;
+		for (unsigned int rowCounter = stream * rowsPerStream; rowCounter < std::min((stream + 1) * rowsPerStream, rowCount); ++rowCounter) {
+			unsigned int row = firstRow + rowCounter * rowStep;
+			unsigned int firstColumn = pass.diamond || row % pass.spacing == 0 ? pass.half : 0;
+			for (unsigned int column = firstColumn; column < dimension; column += pass.spacing) {
+				visit(row, column);
+			}
+		}
+	}
+
+	//Predict a height from the heights of the coarser levels around it. The sums are always taken in the same order so that
+	//the coder and the decoder predict exactly the same height.
+	static float predict(const std::vector<float>& heights, unsigned int dimension, const Pass& pass, unsigned int row, unsigned int column) {
+
+		unsigned int half = pass.half;
+		if (pass.diamond) {
+			return (heights[(size_t)(row - half) * dimension + column - half] + heights[(size_t)(row - half) * dimension + column + half] +
+				heights[(size_t)(row + half) * dimension + column - half] + heights[(size_t)(row + half) * dimension + column + half]) * 0.25f;
+		}
+
+		float sum = 0.0;
+		unsigned int count = 0;
+		if (row >= half) {
+			sum += heights[(size_t)(row - half) * dimension + column];
+			++count;
+		}
+		if (row + half < dimension) {
+			sum += heights[(size_t)(row + half) * dimension + column];
+			++count;
+		}
+		if (column >= half) {
+			sum += heights[(size_t)row * dimension + column - half];
+			++count;
+		}
+		if (column + half < dimension) {
+			sum += heights[(size_t)row * dimension + column + half];
+			++count;
+		}
+		return count == 4 ? sum * 0.25f : sum / count;
+	}
+
+	//Run a function for each stream of a pass, spread over the given number of threads, or one for every core
+	static void runStreams(unsigned int streamCount, unsigned int threadCount, const std::function<void(unsigned int)>& processStream) {
+
+		if (threadCount == 0) {
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		threadCount = std::min(threadCount, streamCount);
+		std::vector<std::thread> threads;
+		for (unsigned int threadCounter = 1; threadCounter < threadCount; ++threadCounter) {
+			threads.push_back(std::thread([threadCounter, threadCount, streamCount, &processStream] {
+				for (unsigned int stream = threadCounter; stream < streamCount; stream += threadCount) {
+					processStream(stream);
+				}
+			}));
+		}
+		for (unsigned int stream = 0; stream < streamCount; stream += threadCount) {
+			processStream(stream);
+		}
+		for (unsigned int threadCounter = 0; threadCounter < threads.size(); ++threadCounter) {
+			threads[threadCounter].join();
+		}
+	}
+
+	//Code a height as its difference from the prediction. Lossy heights are replaced with what the decoder will get.
+	static void encodeHeight(float& height, float prediction, const SampleCoder& sampleCoder, RiceParameter& riceParameter, BitWriter& writer) {
+
+		long long code = sampleCoder.toCode(height), residual = code - sampleCoder.toCode(prediction);
+		unsigned long long value = ((unsigned long long)residual << 1) ^ (unsigned long long)(residual >> 63);
+		writer.writeRice(value, riceParameter.get());
+		riceParameter.update(value);
+		height = sampleCoder.fromCode(code);
+	}
+
+	static float decodeHeight(float prediction, const SampleCoder& sampleCoder, RiceParameter& riceParameter, BitReader& reader) {
+
+		unsigned long long value = reader.readRice(riceParameter.get());
+		riceParameter.update(value);
+		long long residual = (long long)(value >> 1) ^ -(long long)(value & 1);
+		return sampleCoder.fromCode(sampleCoder.toCode(prediction) + residual);
+	}
+
+	//Decode the coarsest levels, which make up a heightmap of 2^levelCount + 1 heights a side. Only the streams of those levels
+	//have to be in the data, so the levels of data that is still being read can be decoded.
+	static bool decodeLevels(const Header& header, const unsigned char* streamData, unsigned long long dataSize, const unsigned long long* streamSizes,
+		unsigned int levelCount, TiledHeightMap& heightMap, unsigned int threadCount) {
+
+		unsigned int dimension = (1u << levelCount) + 1;
+		std::vector<Pass> passes = getPasses(dimension, levelCount);
+		unsigned long long streamCount = 1, streamBytes = 0;
+		for (unsigned int passCounter = 0; passCounter < passes.size(); ++passCounter) {
+			streamCount += getStreamCount(dimension, passes[passCounter]);
+		}
+		for (unsigned long long stream = 0; stream < streamCount; ++stream) {
+			if (streamSizes[stream] > dataSize - streamBytes) {
+				return false;
+			}
+			streamBytes += streamSizes[stream];
+		}
+
+		SampleCoder sampleCoder = { header.lossy != 0, header.step };
+		std::vector<float> heights((size_t)dimension * dimension, 0.0f);
+
+		//The corners are predicted from zero
+		BitReader cornerReader(streamData, (size_t)streamSizes[0]);
+		RiceParameter cornerParameter;
+		unsigned int corners[4] = { 0, dimension - 1, (dimension - 1) * dimension, dimension * dimension - 1 };
+		for (unsigned int corner = 0; corner < 4; ++corner) {
+			heights[corners[corner]] = decodeHeight(0.0f, sampleCoder, cornerParameter, cornerReader);
+		}
+		bool damaged = cornerReader.isOverrun();
+
+		size_t streamIndex = 1;
+		const unsigned char* nextStream = streamData + streamSizes[0];
+		for (unsigned int passCounter = 0; passCounter < passes.size() && !damaged; ++passCounter) {
+
+			const Pass& pass = passes[passCounter];
+			unsigned int streamCount = getStreamCount(dimension, pass);
+			std::vector<const unsigned char*> passStreams;
+			for (unsigned int stream = 0; stream < streamCount; ++stream) {
+				passStreams.push_back(nextStream);
+				nextStream += streamSizes[streamIndex + stream];
+			}
+
+			std::atomic<bool> overrun(false);
+			runStreams(streamCount, threadCount, [&](unsigned int stream) {
+				BitReader reader(passStreams[stream], (size_t)streamSizes[streamIndex + stream]);
+				RiceParameter riceParameter;
+				visitStream(dimension, pass, stream, [&](unsigned int row, unsigned int column) {
+					heights[(size_t)row * dimension + column] = decodeHeight(predict(heights, dimension, pass, row, column), sampleCoder, riceParameter, reader);
+				});
+				if (reader.isOverrun()) {
+					overrun = true;
+				}
+			});
+			damaged = overrun;
+			streamIndex += streamCount;
+		}
+		if (damaged) {
+			return false;
+		}
+
+		heightMap = TiledHeightMap(dimension);
+		for (unsigned int row = 0; row < dimension; ++row) {
+			for (unsigned int column = 0; column < dimension; ++column) {
+				heightMap.set(row, column, heights[(size_t)row * dimension + column]);
+			}
+		}
+		return true;
+	}
+
+	//Check the header and find the stream sizes and the streams. Returns the number of levels, or -1 if the data cannot be decoded.
+	static int readHeader(const unsigned char* encoded, size_t size, Header& header, const unsigned long long*& streamSizes, const unsigned char*& streamData) {
+
+		if (size < sizeof(Header)) {
+			return -1;
+		}
+		std::memcpy(&header, encoded, sizeof(Header));
+		unsigned int dimension = header.dimension;
+		if (std::memcmp(header.magic, "THCC", 4) != 0 || header.version != FORMAT_VERSION || dimension < 2 || ((dimension - 1) & (dimension - 2)) != 0 ||
+			header.levelCount > 31 || (1u << header.levelCount) + 1 != dimension || (header.lossy != 0 && !(header.step > 0.0))) {
+			return -1;
+		}
+
+		//The stream count follows from the dimension
+		unsigned long long streamCount = 1;
+		std::vector<Pass> passes = getPasses(dimension, header.levelCount);
+		for (unsigned int passCounter = 0; passCounter < passes.size(); ++passCounter) {
+			streamCount += getStreamCount(dimension, passes[passCounter]);
+		}
+		if (header.streamCount != streamCount || (size - sizeof(Header)) / sizeof(unsigned long long) < streamCount) {
+			return -1;
+		}
+		streamSizes = (const unsigned long long*)(encoded + sizeof(Header));
+		streamData = encoded + sizeof(Header) + streamCount * sizeof(unsigned long long);
+		return (int)header.levelCount;
+	}
+
+public:
+
+	//Code a heightmap, which must be 2^n + 1 heights a side, on the given number of threads, or one for every core. With a
+	//maximum error of zero the heights are kept exactly. Throws std::invalid_argument if the maximum error is too small for
+	//floats to hold at the size of the heights.
+	static void encode(const TiledHeightMap& heightMap, float maxError, std::vector<unsigned char>& encoded, unsigned int threadCount = 0) {
+
+		unsigned int dimension = heightMap.getDimension(), levelCount = 0;
+		while ((1u << levelCount) + 1 < dimension) {
+			++levelCount;
+		}
+		std::vector<float> heights;
+		heightMap.toVector(heights);
+
+		//A decoded height is the nearest float to a multiple of the step, which can be off by half a float step at the largest
+		//height. The step leaves twice that out of the maximum error.
+		SampleCoder sampleCoder = { maxError > 0.0, 0.0 };
+		if (sampleCoder.lossy) {
+			float maxMagnitude = 0.0;
+			for (size_t height = 0; height < heights.size(); ++height) {
+				maxMagnitude = std::max(maxMagnitude, std::abs(heights[height]));
+			}
+			double resolution = std::numeric_limits<float>::epsilon() * std::max((double)maxMagnitude + maxError, (double)std::numeric_limits<float>::min());
+			if (maxError < 2.0 * resolution) {
+				throw std::invalid_argument("Maximum error is below what floats can hold at these heights.");
+			}
+			sampleCoder.step = 2.0 * (maxError - resolution);
+		}
+
+		std::vector<std::vector<unsigned char> > streams(1);
+		BitWriter cornerWriter(streams[0]);
+		RiceParameter cornerParameter;
+		unsigned int corners[4] = { 0, dimension - 1, (dimension - 1) * dimension, dimension * dimension - 1 };
+		for (unsigned int corner = 0; corner < 4; ++corner) {
+			encodeHeight(heights[corners[corner]], 0.0f, sampleCoder, cornerParameter, cornerWriter);
+		}
+		cornerWriter.flush();
+
+		std::vector<Pass> passes = getPasses(dimension, levelCount);
+		for (unsigned int passCounter = 0; passCounter < passes.size(); ++passCounter) {
+
+			const Pass& pass = passes[passCounter];
+			unsigned int streamCount = getStreamCount(dimension, pass);
+			size_t firstStream = streams.size();
+			streams.resize(firstStream + streamCount);
+			runStreams(streamCount, threadCount, [&](unsigned int stream) {
+				BitWriter writer(streams[firstStream + stream]);
+				RiceParameter riceParameter;
+				visitStream(dimension, pass, stream, [&](unsigned int row, unsigned int column) {
+					encodeHeight(heights[(size_t)row * dimension + column], predict(heights, dimension, pass, row, column), sampleCoder, riceParameter, writer);
+				});
+				writer.flush();
+			});
+		}
+
+		Header header;
+		std::memset(&header, 0, sizeof(Header));
+		std::memcpy(header.magic, "THCC", 4);
+		header.version = FORMAT_VERSION;
+		header.dimension = dimension;
+		header.levelCount = levelCount;
+		header.lossy = sampleCoder.lossy ? 1 : 0;
+		header.maxError = sampleCoder.lossy ? maxError : 0.0f;
+		header.step = sampleCoder.step;
+		header.streamCount = streams.size();
+
+		std::vector<unsigned long long> streamSizes;
+		size_t encodedSize = sizeof(Header) + streams.size() * sizeof(unsigned long long);
+		for (size_t stream = 0; stream < streams.size(); ++stream) {
+			streamSizes.push_back(streams[stream].size());
+			encodedSize += streams[stream].size();
+		}
+		encoded.resize(encodedSize);
+		std::memcpy(encoded.data(), &header, sizeof(Header));
+		std::memcpy(&encoded[sizeof(Header)], streamSizes.data(), streamSizes.size() * sizeof(unsigned long long));
+		size_t offset = sizeof(Header) + streamSizes.size() * sizeof(unsigned long long);
+		for (size_t stream = 0; stream < streams.size(); ++stream) {
+			if (!streams[stream].empty()) {
+				std::memcpy(&encoded[offset], streams[stream].data(), streams[stream].size());
+			}
+			offset += streams[stream].size();
+		}
+	}
+
+	//Get the number of levels in coded data, or -1 if it cannot be decoded. Decoding all of them gives the whole heightmap.
+	static int getLevelCount(const unsigned char* encoded, size_t size) {
+
+		Header header;
+		const unsigned long long* streamSizes;
+		const unsigned char* streamData;
+		return readHeader(encoded, size, header, streamSizes, streamData);
+	}
+
+	//Decode the coarsest levels only, which gives a heightmap of 2^levelCount + 1 heights a side with every 2^k th height of the
+	//whole one. Only the start of the data is read, and only it has to be there. Returns false if the data is damaged or has
+	//fewer levels. The streams are decoded on the given number of threads, or one for every core.
+	static bool decode(const unsigned char* encoded, size_t size, unsigned int levelCount, TiledHeightMap& heightMap, unsigned int threadCount = 0) {
+
+		Header header;
+		const unsigned long long* streamSizes;
+		const unsigned char* streamData;
+		int availableLevels = readHeader(encoded, size, header, streamSizes, streamData);
+		if (availableLevels < 0 || levelCount > (unsigned int)availableLevels) {
+			return false;
+		}
+		return decodeLevels(header, streamData, size - (streamData - encoded), streamSizes, levelCount, heightMap, threadCount);
+	}
+
+	//Decode the whole heightmap
+	static bool decode(const unsigned char* encoded, size_t size, TiledHeightMap& heightMap, unsigned int threadCount = 0) {
+
+		int levelCount = getLevelCount(encoded, size);
+		return levelCount >= 0 && decode(encoded, size, levelCount, heightMap, threadCount);
+	}
+
+	//Code a heightmap into a file. Returns false if the file cannot be written.
+	static bool save(const std::string& fileName, const TiledHeightMap& heightMap, float maxError, unsigned int threadCount = 0) {
+
+		std::vector<unsigned char> encoded;
+		encode(heightMap, maxError, encoded, threadCount);
+		FILE* file = fopen(fileName.c_str(), "wb");
+		if (file == NULL) {
+			return false;
+		}
+		bool written = fwrite(encoded.data(), encoded.size(), 1, file) == 1;
+		written = fclose(file) == 0 && written;
+		if (!written) {
+			remove(fileName.c_str());
+		}
+		return written;
+	}
+
+	//Decode the coarsest levels of a file, or all of them if the level count is negative. The file is mapped, so only the
+	//part that is decoded is read from disk.
+	static bool load(const std::string& fileName, int levelCount, TiledHeightMap& heightMap, unsigned int threadCount = 0) {
+
+		MappedFile file;
+		if (!file.open(fileName.c_str())) {
+			return false;
+		}
+		return levelCount < 0 ? decode(file.getData(), file.getSize(), heightMap, threadCount) :
+			decode(file.getData(), file.getSize(), levelCount, heightMap, threadCount);
+	}
+
+};
@@ -0,0 +1,409 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "HeightBandSink.hpp"
+#include "MappedFile.hpp"
+#include "Terrain.hpp"
+#include "TiledHeightMap.hpp"
+
+//What a heightmap file records about its heights besides the heights themselves
+struct HeightMapInfo {
+
+	//Seed and generator the heights were made with, so that they can be made again
+	unsigned int seed;
+	std::string generatorName, generatorParameters;
+
+	//Heights are stored in model units. The height in world units is the stored height times the scale plus the offset.
+	float scale, offset;
+};
+
+//Terrain whose heights were loaded from a heightmap file. It reports the generator recorded in the file.
+class LoadedTerrain : public Terrain {
+
+private:
+
+	std::string generatorName, generatorParameters;
+
+public:
+
+	//Constructor
+	LoadedTerrain(const TiledHeightMap& heightMap, const HeightMapInfo& info) : Terrain(heightMap.getDimension(), info.seed) {
+		this->heightMap = heightMap;
+		this->generatorName = info.generatorName;
+		this->generatorParameters = info.generatorParameters;
+	}
+
+	//The heights are already there
+	void makeTerrain() {
+	}
+
+	std::string getGeneratorName() {
+		return this->generatorName;
+	}
+
+	std::string getGeneratorParameters() {
+		return this->generatorParameters;
+	}
+
+};
+
+//This class saves heightmaps to files and loads them back. A file has a header, a table with the offset of every tile, and the
+//tiles as 32 bit floats in the layout TiledHeightMap keeps in memory. Each tile starts at a multiple of the tile size, so the
+//tiles are page aligned. Tiles that were never allocated are not stored. Files are written in large sequential writes and
+//loaded by mapping them, and the heightmap reads its tiles in place in the mapping, so loading copies no heights at all.
+class HeightMapFile {
+
+private:
+
+	//Changed whenever the layout of the file changes
+	static const unsigned int FORMAT_VERSION = 1;
+
+	//Types of the stored heights. Only 32 bit floats are written for now.
+	static const unsigned int SAMPLE_FLOAT32 = 1;
+
+	//Number of tiles gathered into each write
+	static const unsigned int TILES_PER_WRITE = 256;
+
+	//Start of a file. Numbers are stored in the byte order of the machine that wrote them, which is little endian on every
+	//machine this runs on. The tile table is an unsigned 64 bit offset for every tile, one row of tiles after the other,
+	//with 0 for a tile of zeros.
+	struct Header {
+		char magic[4];
+		unsigned int version, dimension, tileDimension, sampleType, seed;
+		float scale, offset;
+		unsigned long long tableOffset, dataOffset;
+		char generatorName[32];
+		char generatorParameters[192];
+	};
+
+	//Copy a string into a fixed size field, cutting it short if it does not fit
+	static void writeString(const std::string& text, char* field, size_t fieldSize) {
+		std::memset(field, 0, fieldSize);
+		std::memcpy(field, text.data(), std::min(text.size(), fieldSize - 1));
+	}
+
+	//Read a string from a fixed size field, which need not end in a null
+	static std::string readString(const char* field, size_t fieldSize) {
+		return std::string(field, std::find(field, field + fieldSize, '\0'));
+	}
+
+	//Fill in a header for the heights of the given dimension
+	static void setHeader(unsigned int dimension, const HeightMapInfo& info, Header& header) {
+
+		const size_t TILE_BYTES = TiledHeightMap::TILE_DIMENSION * TiledHeightMap::TILE_DIMENSION * sizeof(float);
+		size_t tilesPerSide = (dimension + TiledHeightMap::TILE_DIMENSION - 1) / TiledHeightMap::TILE_DIMENSION;
+
+		std::memset(&header, 0, sizeof(Header));
+		std::memcpy(header.magic, "THMF", 4);
+		header.version = FORMAT_VERSION;
+		header.dimension = dimension;
+		header.tileDimension = TiledHeightMap::TILE_DIMENSION;
+		header.sampleType = SAMPLE_FLOAT32;
+		header.seed = info.seed;
+		header.scale = info.scale;
+		header.offset = info.offset;
+		header.tableOffset = sizeof(Header);
+		header.dataOffset = (sizeof(Header) + tilesPerSide * tilesPerSide * sizeof(unsigned long long) + TILE_BYTES - 1) / TILE_BYTES * TILE_BYTES;
+		writeString(info.generatorName, header.generatorName, sizeof(header.generatorName));
+		writeString(info.generatorParameters, header.generatorParameters, sizeof(header.generatorParameters));
+	}
+
+	//Move to a byte offset in a file, which may be past 4 GB
+	static bool seek(FILE* file, unsigned long long offset) {
+#ifdef _WIN32
+		return _fseeki64(file, (long long)offset, SEEK_SET) == 0;
+#else
+		return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+	}
+
+	//Open a new file to write heights into before it is renamed to its file name. Several processes can share a directory, for
+	//example a terrain cache, so the name holds the process id and a count, and a file that already exists is never opened.
+	static FILE* openPartFile(const std::string& fileName, std::string& partName) {
+
+		static std::atomic<unsigned int> partCount(0);
+#ifdef _WIN32
+		unsigned long processId = GetCurrentProcessId();
+#else
+		unsigned long processId = (unsigned long)getpid();
+#endif
+		for (unsigned int attempt = 0; attempt < 100; ++attempt) {
+			std::stringstream name;
+			name << fileName << ".part." << processId << "." << partCount++;
+			partName = name.str();
+			FILE* file = fopen(partName.c_str(), "wbx");
+			if (file != NULL || errno != EEXIST) {
+				return file;
+			}
+		}
+		return NULL;
+	}
+
+	//Put a complete file in place of any file of the same name. Either file is always there for readers, never neither.
+	static bool replaceFile(const std::string& partName, const std::string& fileName) {
+#ifdef _WIN32
+		return MoveFileExA(partName.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return rename(partName.c_str(), fileName.c_str()) == 0;
+#endif
+	}
+
+public:
+
+	//Writes a heightmap file from heights that come a band of rows at a time, so that a heightmap too large to hold can be saved
+	//as it is made. The rows are gathered into a row of tiles, and each row of tiles is written as soon as it is complete, with
+	//its part of the tile table written in place. Tiles of zeros are not stored. Like save, the file is written under a
+	//temporary name and renamed when it is complete.
+	class BandWriter : public HeightBandSink {
+
+	private:
+
+		std::string fileName, partName;
+		FILE* file;
+		Header header;
+		unsigned int tilesPerSide;
+
+		//Heights of the row of tiles being gathered, one row after the other, and the number of rows taken so far
+		std::vector<float> tileRowHeights;
+		unsigned int takenRows;
+
+		//Tiles and tile table entries of a row of tiles, and where the next tile goes in the file
+		std::vector<float> tiles;
+		std::vector<unsigned long long> tileOffsets;
+		unsigned long long nextOffset;
+
+		bool failed;
+
+		//A file belongs to one writer
+		BandWriter(const BandWriter&);
+		BandWriter& operator=(const BandWriter&);
+
+		//Cut the gathered rows into tiles and write the ones that are not all zeros
+		void writeTileRow() {
+
+			const unsigned int TILE_DIMENSION = TiledHeightMap::TILE_DIMENSION;
+			unsigned int dimension = this->header.dimension, tileRow = (this->takenRows - 1) / TILE_DIMENSION;
+			unsigned int rowCount = std::min(TILE_DIMENSION, dimension - tileRow * TILE_DIMENSION);
+			size_t storedTiles = 0;
+			for (unsigned int tileColumn = 0; tileColumn < this->tilesPerSide; ++tileColumn) {
+
+				//Heights past the right and bottom edges of the heightmap are zeros, as in TiledHeightMap
+				float* tile = &this->tiles[storedTiles * TILE_DIMENSION * TILE_DIMENSION];
+				unsigned int columnCount = std::min(TILE_DIMENSION, dimension - tileColumn * TILE_DIMENSION);
+				std::fill(tile, tile + TILE_DIMENSION * TILE_DIMENSION, 0.0f);
+				for (unsigned int row = 0; row < rowCount; ++row) {
+					const float* rowHeights = &this->tileRowHeights[(size_t)row * dimension + tileColumn * TILE_DIMENSION];
+					std::copy(rowHeights, rowHeights + columnCount, tile + row * TILE_DIMENSION);
+				}
+
+				bool allZeros = std::find_if(tile, tile + TILE_DIMENSION * TILE_DIMENSION, [](float height) { return height != 0.0; }) ==
+					tile + TILE_DIMENSION * TILE_DIMENSION;
+				this->tileOffsets[tileColumn] = allZeros ? 0 : this->nextOffset + storedTiles * TILE_DIMENSION * TILE_DIMENSION * sizeof(float);
+				storedTiles += allZeros ? 0 : 1;
+			}
+
+			//The tiles go at the end of the file and the table entries in the table
+			size_t tileBytes = storedTiles * TILE_DIMENSION * TILE_DIMENSION * sizeof(float);
+			this->failed = this->failed || !seek(this->file, this->nextOffset) || (tileBytes > 0 && fwrite(this->tiles.data(), tileBytes, 1, this->file) != 1) ||
+				!seek(this->file, this->header.tableOffset + (unsigned long long)tileRow * this->tilesPerSide * sizeof(unsigned long long)) ||
+				fwrite(this->tileOffsets.data(), this->tileOffsets.size() * sizeof(unsigned long long), 1, this->file) != 1;
+			this->nextOffset += tileBytes;
+		}
+
+	public:
+
+		//Constructor. The file is started right away.
+		BandWriter(const std::string& fileName, unsigned int dimension, const HeightMapInfo& info) {
+
+			const unsigned int TILE_DIMENSION = TiledHeightMap::TILE_DIMENSION;
+			setHeader(dimension, info, this->header);
+			this->fileName = fileName;
+			this->tilesPerSide = (dimension + TILE_DIMENSION - 1) / TILE_DIMENSION;
+			this->tileRowHeights.resize((size_t)TILE_DIMENSION * dimension);
+			this->takenRows = 0;
+			this->tiles.resize((size_t)this->tilesPerSide * TILE_DIMENSION * TILE_DIMENSION);
+			this->tileOffsets.resize(this->tilesPerSide);
+			this->nextOffset = this->header.dataOffset;
+
+			//The table is filled in a row of tiles at a time and the padding after it is never written, so it reads as zeros
+			this->file = openPartFile(fileName, this->partName);
+			this->failed = this->file == NULL || fwrite(&this->header, sizeof(Header), 1, this->file) != 1;
+		}
+
+		~BandWriter() {
+			if (this->file != NULL) {
+				fclose(this->file);
+				remove(this->partName.c_str());
+			}
+		}
+
+		bool takeBand(unsigned int firstRow, unsigned int rowCount, const float* heights) {
+
+			const unsigned int TILE_DIMENSION = TiledHeightMap::TILE_DIMENSION;
+			unsigned int dimension = this->header.dimension;
+			if (firstRow != this->takenRows || rowCount > dimension - firstRow) {
+				this->failed = true;
+			}
+			for (unsigned int row = 0; row < rowCount && !this->failed; ++row) {
+				std::copy(heights + (size_t)row * dimension, heights + (size_t)(row + 1) * dimension,
+					&this->tileRowHeights[(size_t)(this->takenRows % TILE_DIMENSION) * dimension]);
+				++this->takenRows;
+				if (this->takenRows % TILE_DIMENSION == 0 || this->takenRows == dimension) {
+					writeTileRow();
+				}
+			}
+			return !this->failed;
+		}
+
+		bool finish() {
+
+			if (this->file == NULL) {
+				return false;
+			}
+			bool written = !this->failed && this->takenRows == this->header.dimension;
+			written = fclose(this->file) == 0 && written;
+			this->file = NULL;
+			if (!written || !replaceFile(this->partName, this->fileName)) {
+				remove(this->partName.c_str());
+				return false;
+			}
+			return true;
+		}
+
+	};
+
+	//Get what a file records about the heights of a terrain: its seed and generator, with the heights as they are
+	static HeightMapInfo getInfo(Terrain& terrain) {
+
+		HeightMapInfo info;
+		info.seed = terrain.getSeed();
+		info.generatorName = terrain.getGeneratorName();
+		info.generatorParameters = terrain.getGeneratorParameters();
+		info.scale = 1.0;
+		info.offset = 0.0;
+		return info;
+	}
+
+	//Save the heights. The file is written under a temporary name and renamed when it is complete, so a file that exists is
+	//never partly written. Returns false if the file cannot be written.
+	static bool save(const std::string& fileName, const TiledHeightMap& heightMap, const HeightMapInfo& info) {
+
+		const size_t TILE_BYTES = TiledHeightMap::TILE_DIMENSION * TiledHeightMap::TILE_DIMENSION * sizeof(float);
+		size_t tileCount = (size_t)heightMap.getTilesPerSide() * heightMap.getTilesPerSide();
+
+		Header header;
+		setHeader(heightMap.getDimension(), info, header);
+
+		//The allocated tiles are stored one after the other in table order
+		std::vector<unsigned long long> tileOffsets(tileCount, 0);
+		unsigned long long nextOffset = header.dataOffset;
+		for (size_t tile = 0; tile < tileCount; ++tile) {
+			if (heightMap.isAllocatedTile(tile / heightMap.getTilesPerSide(), tile % heightMap.getTilesPerSide())) {
+				tileOffsets[tile] = nextOffset;
+				nextOffset += TILE_BYTES;
+			}
+		}
+
+		std::string partName;
+		FILE* file = openPartFile(fileName, partName);
+		if (file == NULL) {
+			return false;
+		}
+
+		//The header, the table and the padding up to the first tile go out in one write
+		std::vector<unsigned char> buffer(header.dataOffset, 0);
+		std::memcpy(buffer.data(), &header, sizeof(Header));
+		std::memcpy(&buffer[sizeof(Header)], tileOffsets.data(), tileCount * sizeof(unsigned long long));
+		bool written = fwrite(buffer.data(), buffer.size(), 1, file) == 1;
+
+		//Then the tiles, many at a time
+		buffer.resize(TILES_PER_WRITE * TILE_BYTES);
+		size_t bufferedBytes = 0;
+		for (size_t tile = 0; tile < tileCount && written; ++tile) {
+			if (tileOffsets[tile] != 0) {
+				std::memcpy(&buffer[bufferedBytes], heightMap.getTile(tile / heightMap.getTilesPerSide(), tile % heightMap.getTilesPerSide()), TILE_BYTES);
+				bufferedBytes += TILE_BYTES;
+			}
+			if (bufferedBytes == buffer.size() || (tile == tileCount - 1 && bufferedBytes > 0)) {
+				written = fwrite(buffer.data(), bufferedBytes, 1, file) == 1;
+				bufferedBytes = 0;
+			}
+		}
+
+		written = fclose(file) == 0 && written;
+		if (!written || !replaceFile(partName, fileName)) {
+			remove(partName.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	//Save the heights of a terrain with its seed and generator
+	static bool save(const std::string& fileName, Terrain& terrain) {
+		return save(fileName, terrain.getHeightMap(), getInfo(terrain));
+	}
+
+	//Load the heights by mapping the file. Returns false if it is not a heightmap file this version can read.
+	static bool load(const std::string& fileName, TiledHeightMap& heightMap, HeightMapInfo& info) {
+
+		const size_t TILE_BYTES = TiledHeightMap::TILE_DIMENSION * TiledHeightMap::TILE_DIMENSION * sizeof(float);
+		std::shared_ptr<MappedFile> file(new MappedFile());
+		if (!file->open(fileName.c_str()) || file->getSize() < sizeof(Header)) {
+			return false;
+		}
+
+		Header header;
+		std::memcpy(&header, file->getData(), sizeof(Header));
+		if (std::memcmp(header.magic, "THMF", 4) != 0 || header.version != FORMAT_VERSION || header.tileDimension != TiledHeightMap::TILE_DIMENSION ||
+			header.sampleType != SAMPLE_FLOAT32 || header.dimension < 2 || ((header.dimension - 1) & (header.dimension - 2)) != 0) {
+			return false;
+		}
+
+		size_t tilesPerSide = (header.dimension + TiledHeightMap::TILE_DIMENSION - 1) / TiledHeightMap::TILE_DIMENSION;
+		size_t tileCount = tilesPerSide * tilesPerSide;
+		if (header.tableOffset % sizeof(unsigned long long) != 0 || header.tableOffset + tileCount * sizeof(unsigned long long) > file->getSize()) {
+			return false;
+		}
+
+		//Every tile has to lie within the file and be aligned for floats
+		const unsigned long long* tileOffsets = (const unsigned long long*)(file->getData() + header.tableOffset);
+		std::vector<const float*> fileTiles(tileCount, (const float*)NULL);
+		for (size_t tile = 0; tile < tileCount; ++tile) {
+			if (tileOffsets[tile] == 0) {
+				continue;
+			}
+			if (tileOffsets[tile] % sizeof(float) != 0 || tileOffsets[tile] > file->getSize() || file->getSize() - tileOffsets[tile] < TILE_BYTES) {
+				return false;
+			}
+			fileTiles[tile] = (const float*)(file->getData() + tileOffsets[tile]);
+		}
+
+		heightMap = TiledHeightMap(header.dimension, file, fileTiles);
+		info.seed = header.seed;
+		info.generatorName = readString(header.generatorName, sizeof(header.generatorName));
+		info.generatorParameters = readString(header.generatorParameters, sizeof(header.generatorParameters));
+		info.scale = header.scale;
+		info.offset = header.offset;
+		return true;
+	}
+
+	//Load a terrain. Returns an empty pointer if the file cannot be loaded.
+	static std::shared_ptr<Terrain> loadTerrain(const std::string& fileName) {
+
+		TiledHeightMap heightMap;
+		HeightMapInfo info;
+		if (!load(fileName, heightMap, info)) {
+			return std::shared_ptr<Terrain>();
+		}
+		return std::shared_ptr<Terrain>(new LoadedTerrain(heightMap, info));
+	}
+
+};
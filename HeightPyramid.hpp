@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "TiledHeightMap.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#ifndef TERRAIN_USE_SSE
+#define TERRAIN_USE_SSE
+#endif
+#endif
+
+//This class keeps the minimum and maximum heights of a 2^n+1 heightmap for square blocks of cells. Level 0 has one entry for
+//each cell of the heightmap and every level above combines 2x2 entries of the level below, so that the top level covers the
+//whole terrain. The heights of the vertices on the edges of a block are included in the block.
+class HeightPyramid {
+
+private:
+
+	unsigned int terrainDimension, levelCount;
+
+	std::vector<std::vector<float>> minHeights, maxHeights;
+
+	//Heights of the two rows of vertices around a row of cells, copied out of the heightmap tiles
+	std::vector<float> topHeights, bottomHeights;
+
+	//Find the minimum and maximum of the four heightmap vertices around each cell in the rows given
+	void buildFirstLevel(const TiledHeightMap& heightMap, unsigned int firstRow, unsigned int lastRow, unsigned int firstColumn, unsigned int lastColumn) {
+
+		unsigned int cellDimension = this->terrainDimension - 1, vertexCount = lastColumn - firstColumn + 2;
+		this->topHeights.resize(vertexCount);
+		this->bottomHeights.resize(vertexCount);
+		heightMap.getRow(firstRow, firstColumn, vertexCount, this->bottomHeights.data());
+
+		for (auto row = firstRow; row <= lastRow; ++row) {
+
+			//The bottom vertices of a row of cells are the top vertices of the next row
+			this->topHeights.swap(this->bottomHeights);
+			heightMap.getRow(row + 1, firstColumn, vertexCount, this->bottomHeights.data());
+			const float* topRow = this->topHeights.data();
+			const float* bottomRow = this->bottomHeights.data();
+			float* minRow = &this->minHeights[0][row * cellDimension + firstColumn];
+			float* maxRow = &this->maxHeights[0][row * cellDimension + firstColumn];
+
+			unsigned int column = 0, columnCount = lastColumn - firstColumn + 1;
+#ifdef TERRAIN_USE_SSE
+			for (; column + 4 <= columnCount; column += 4) {
+				__m128 topLeft = _mm_loadu_ps(topRow + column), topRight = _mm_loadu_ps(topRow + column + 1);
+				__m128 bottomLeft = _mm_loadu_ps(bottomRow + column), bottomRight = _mm_loadu_ps(bottomRow + column + 1);
+				_mm_storeu_ps(minRow + column, _mm_min_ps(_mm_min_ps(topLeft, topRight), _mm_min_ps(bottomLeft, bottomRight)));
+				_mm_storeu_ps(maxRow + column, _mm_max_ps(_mm_max_ps(topLeft, topRight), _mm_max_ps(bottomLeft, bottomRight)));
+			}
+#endif
+			for (; column < columnCount; ++column) {
+				minRow[column] = std::min(std::min(topRow[column], topRow[column + 1]), std::min(bottomRow[column], bottomRow[column + 1]));
+				maxRow[column] = std::max(std::max(topRow[column], topRow[column + 1]), std::max(bottomRow[column], bottomRow[column + 1]));
+			}
+		}
+	}
+
+	//Combine 2x2 blocks of the level below into the given rows and columns of this level
+	void buildLevel(unsigned int level, unsigned int firstRow, unsigned int lastRow, unsigned int firstColumn, unsigned int lastColumn) {
+
+		unsigned int levelDimension = getLevelDimension(level), childDimension = 2 * levelDimension;
+		for (auto row = firstRow; row <= lastRow; ++row) {
+
+			const float* topMinRow = &this->minHeights[level - 1][2 * row * childDimension];
+			const float* bottomMinRow = topMinRow + childDimension;
+			const float* topMaxRow = &this->maxHeights[level - 1][2 * row * childDimension];
+			const float* bottomMaxRow = topMaxRow + childDimension;
+			float* minRow = &this->minHeights[level][row * levelDimension];
+			float* maxRow = &this->maxHeights[level][row * levelDimension];
+
+			unsigned int column = firstColumn;
+#ifdef TERRAIN_USE_SSE
+			for (; column + 4 <= lastColumn + 1; column += 4) {
+				//Combine the two child rows and then the even and odd children of each pair
+				__m128 minLow = _mm_min_ps(_mm_loadu_ps(topMinRow + 2 * column), _mm_loadu_ps(bottomMinRow + 2 * column));
+				__m128 minHigh = _mm_min_ps(_mm_loadu_ps(topMinRow + 2 * column + 4), _mm_loadu_ps(bottomMinRow + 2 * column + 4));
+				_mm_storeu_ps(minRow + column, _mm_min_ps(_mm_shuffle_ps(minLow, minHigh, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(minLow, minHigh, _MM_SHUFFLE(3, 1, 3, 1))));
+				__m128 maxLow = _mm_max_ps(_mm_loadu_ps(topMaxRow + 2 * column), _mm_loadu_ps(bottomMaxRow + 2 * column));
+				__m128 maxHigh = _mm_max_ps(_mm_loadu_ps(topMaxRow + 2 * column + 4), _mm_loadu_ps(bottomMaxRow + 2 * column + 4));
+				_mm_storeu_ps(maxRow + column, _mm_max_ps(_mm_shuffle_ps(maxLow, maxHigh, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(maxLow, maxHigh, _MM_SHUFFLE(3, 1, 3, 1))));
+			}
+#endif
+			for (; column <= lastColumn; ++column) {
+				minRow[column] = std::min(std::min(topMinRow[2 * column], topMinRow[2 * column + 1]), std::min(bottomMinRow[2 * column], bottomMinRow[2 * column + 1]));
+				maxRow[column] = std::max(std::max(topMaxRow[2 * column], topMaxRow[2 * column + 1]), std::max(bottomMaxRow[2 * column], bottomMaxRow[2 * column + 1]));
+			}
+		}
+	}
+
+	//Find where the ray enters and leaves a box. Returns false if the ray misses the box.
+	bool intersectBox(const float origin[3], const float direction[3], const float boxMin[3], const float boxMax[3], float& entryDistance, float& exitDistance) {
+
+		entryDistance = 0.0;
+		exitDistance = std::numeric_limits<float>::max();
+		for (auto axis = 0; axis < 3; ++axis) {
+			if (direction[axis] == 0.0) {
+				if (origin[axis] < boxMin[axis] || origin[axis] > boxMax[axis]) {
+					return false;
+				}
+				continue;
+			}
+			float nearDistance = (boxMin[axis] - origin[axis]) / direction[axis], farDistance = (boxMax[axis] - origin[axis]) / direction[axis];
+			if (nearDistance > farDistance) {
+				std::swap(nearDistance, farDistance);
+			}
+			entryDistance = std::max(entryDistance, nearDistance);
+			exitDistance = std::min(exitDistance, farDistance);
+		}
+		return entryDistance <= exitDistance;
+	}
+
+	//Find the distance along the ray to the triangle. Returns false if the ray misses the triangle.
+	bool intersectTriangle(const float origin[3], const float direction[3], const float a[3], const float b[3], const float c[3], float& distance) {
+
+		float edge1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, edge2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		float p[3] = { direction[1] * edge2[2] - direction[2] * edge2[1], direction[2] * edge2[0] - direction[0] * edge2[2], direction[0] * edge2[1] - direction[1] * edge2[0] };
+		float determinant = edge1[0] * p[0] + edge1[1] * p[1] + edge1[2] * p[2];
+		if (std::abs(determinant) < 1.0e-12) {
+			return false;
+		}
+
+		float s[3] = { origin[0] - a[0], origin[1] - a[1], origin[2] - a[2] };
+		float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / determinant;
+		if (u < 0.0 || u > 1.0) {
+			return false;
+		}
+
+		float q[3] = { s[1] * edge1[2] - s[2] * edge1[1], s[2] * edge1[0] - s[0] * edge1[2], s[0] * edge1[1] - s[1] * edge1[0] };
+		float v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) / determinant;
+		if (v < 0.0 || u + v > 1.0) {
+			return false;
+		}
+
+		distance = (edge2[0] * q[0] + edge2[1] * q[1] + edge2[2] * q[2]) / determinant;
+		return distance >= 0.0;
+	}
+
+	//Intersect the ray with the block and its children, skipping blocks the ray misses or only reaches after the closest hit so far
+	void intersectBlock(const TiledHeightMap& heightMap, const float origin[3], const float direction[3], unsigned int level, unsigned int row, unsigned int column, float& closestDistance) {
+
+		unsigned int blockSize = 1 << level;
+		float boxMin[3] = { (float)(column * blockSize), getMinHeight(level, row, column), (float)(row * blockSize) };
+		float boxMax[3] = { (float)((column + 1) * blockSize), getMaxHeight(level, row, column), (float)((row + 1) * blockSize) };
+		float entryDistance, exitDistance;
+		if (!intersectBox(origin, direction, boxMin, boxMax, entryDistance, exitDistance) || entryDistance > closestDistance) {
+			return;
+		}
+
+		if (level == 0) {
+			//Check the two triangles of the cell
+			float topLeft[3] = { (float)column, heightMap.get(row, column), (float)row };
+			float topRight[3] = { (float)(column + 1), heightMap.get(row, column + 1), (float)row };
+			float bottomLeft[3] = { (float)column, heightMap.get(row + 1, column), (float)(row + 1) };
+			float bottomRight[3] = { (float)(column + 1), heightMap.get(row + 1, column + 1), (float)(row + 1) };
+			float distance;
+			if (intersectTriangle(origin, direction, topLeft, bottomLeft, bottomRight, distance) && distance < closestDistance) {
+				closestDistance = distance;
+			}
+			if (intersectTriangle(origin, direction, topLeft, bottomRight, topRight, distance) && distance < closestDistance) {
+				closestDistance = distance;
+			}
+			return;
+		}
+
+		for (unsigned int quadrant = 0; quadrant < 4; ++quadrant) {
+			intersectBlock(heightMap, origin, direction, level - 1, 2 * row + quadrant / 2, 2 * column + quadrant % 2, closestDistance);
+		}
+	}
+
+public:
+
+	//Constructor
+	HeightPyramid() {
+		this->terrainDimension = 0;
+		this->levelCount = 0;
+	}
+
+	//Build every level of the pyramid from the heightmap
+	void build(const TiledHeightMap& heightMap) {
+
+		unsigned int dimension = heightMap.getDimension();
+		this->terrainDimension = dimension;
+		this->levelCount = 1;
+		while ((1u << (this->levelCount - 1)) < dimension - 1) {
+			++this->levelCount;
+		}
+
+		this->minHeights.resize(this->levelCount);
+		this->maxHeights.resize(this->levelCount);
+		for (unsigned int level = 0; level < this->levelCount; ++level) {
+			this->minHeights[level].resize(getLevelDimension(level) * getLevelDimension(level));
+			this->maxHeights[level].resize(getLevelDimension(level) * getLevelDimension(level));
+		}
+
+		buildFirstLevel(heightMap, 0, dimension - 2, 0, dimension - 2);
+		for (unsigned int level = 1; level < this->levelCount; ++level) {
+			buildLevel(level, 0, getLevelDimension(level) - 1, 0, getLevelDimension(level) - 1);
+		}
+	}
+
+	//Has the pyramid been built
+	bool isBuilt() {
+		return this->levelCount > 0;
+	}
+
+	//Update the pyramid after the heights of the vertices from the first to the last row and column have changed.
+	//Only the blocks containing these vertices are recomputed.
+	void update(const TiledHeightMap& heightMap, unsigned int firstRow, unsigned int firstColumn, unsigned int lastRow, unsigned int lastColumn) {
+
+		//A vertex belongs to the cells on both sides of it
+		unsigned int lastCell = this->terrainDimension - 2;
+		unsigned int firstCellRow = firstRow > 0 ? firstRow - 1 : 0, firstCellColumn = firstColumn > 0 ? firstColumn - 1 : 0;
+		unsigned int lastCellRow = std::min(lastRow, lastCell), lastCellColumn = std::min(lastColumn, lastCell);
+		buildFirstLevel(heightMap, firstCellRow, lastCellRow, firstCellColumn, lastCellColumn);
+
+		for (unsigned int level = 1; level < this->levelCount; ++level) {
+			firstCellRow /= 2;
+			firstCellColumn /= 2;
+			lastCellRow /= 2;
+			lastCellColumn /= 2;
+			buildLevel(level, firstCellRow, lastCellRow, firstCellColumn, lastCellColumn);
+		}
+	}
+
+	//Change every height in the pyramid as height * scale + offset, which keeps it in step with the same change to the heightmap
+	void rescale(float scale, float offset) {
+
+		for (unsigned int level = 0; level < this->levelCount; ++level) {
+			for (unsigned int block = 0; block < this->minHeights[level].size(); ++block) {
+				float minHeight = this->minHeights[level][block] * scale + offset, maxHeight = this->maxHeights[level][block] * scale + offset;
+				this->minHeights[level][block] = std::min(minHeight, maxHeight);
+				this->maxHeights[level][block] = std::max(minHeight, maxHeight);
+			}
+		}
+	}
+
+	//Get the number of levels. The top level has one block covering the terrain.
+	unsigned int getLevelCount() {
+		return this->levelCount;
+	}
+
+	//Get the number of blocks along each side of a level
+	unsigned int getLevelDimension(unsigned int level) {
+		return (this->terrainDimension - 1) >> level;
+	}
+
+	//Get the lowest height in a block
+	float getMinHeight(unsigned int level, unsigned int row, unsigned int column) {
+		return this->minHeights[level][row * getLevelDimension(level) + column];
+	}
+
+	//Get the highest height in a block
+	float getMaxHeight(unsigned int level, unsigned int row, unsigned int column) {
+		return this->maxHeights[level][row * getLevelDimension(level) + column];
+	}
+
+	//Get the lowest height of the terrain
+	float getMinHeight() {
+		return this->minHeights.back().front();
+	}
+
+	//Get the highest height of the terrain
+	float getMaxHeight() {
+		return this->maxHeights.back().front();
+	}
+
+	//Find the distance along a ray to the terrain. Columns, heights and rows are used as the x, y and z coordinates.
+	//Returns false if the ray does not hit the terrain.
+	bool intersectRay(const TiledHeightMap& heightMap, const float origin[3], const float direction[3], float& distance) {
+
+		distance = std::numeric_limits<float>::max();
+		intersectBlock(heightMap, origin, direction, this->levelCount - 1, 0, 0, distance);
+		return distance < std::numeric_limits<float>::max();
+	}
+
+};
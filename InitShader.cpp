@@ -1,55 +1,167 @@
 #define _CRT_SECURE_NO_WARNINGS
+#include <cstring>
+#include <string>
+#include <vector>
 #include "Angel.h"
+#include "MappedFile.hpp"
 
 namespace Angel {
 
-// Create a NULL-terminated string by reading the provided file
-static char*
-readShaderSource(const char* shaderFile)
+// Start of a program cache file. The program binary follows it.
+struct ProgramCacheHeader {
+    char                magic[4];
+    GLenum              binaryFormat;
+    unsigned long long  sourceHash;
+    unsigned long long  binaryLength;
+};
+
+// Read the whole of a shader file. Returns false if it cannot be read.
+static bool
+readShaderSource(const char* shaderFile, std::string& source)
 {
-    FILE* fp = fopen(shaderFile, "r");
+    MappedFile file;
+    if ( !file.open(shaderFile) ) { return false; }
 
-    if ( fp == NULL ) { return NULL; }
+    source.assign( (const char*) file.getData(), file.getSize() );
+    return true;
+}
 
-    fseek(fp, 0L, SEEK_END);
-    long size = ftell(fp);
+// Hash the shader sources together with the driver that compiles them, since
+// a program binary only loads on the driver that made it (64 bit FNV-1a)
+static unsigned long long
+hashProgramSources(const std::string sources[2])
+{
+    const char* driverStrings[3] = {
+	(const char*) glGetString( GL_VENDOR ),
+	(const char*) glGetString( GL_RENDERER ),
+	(const char*) glGetString( GL_VERSION )
+    };
 
-    fseek(fp, 0L, SEEK_SET);
-    char* buf = new char[size + 1];
-    fread(buf, 1, size, fp);
+    std::string key = sources[0] + '\0' + sources[1];
+    for ( int i = 0; i < 3; ++i ) {
+	key += '\0';
+	key += driverStrings[i] != NULL ? driverStrings[i] : "";
+    }
 
-    buf[size] = '\0';
-    fclose(fp);
+    unsigned long long hash = 14695981039346656037ULL;
+    for ( size_t i = 0; i < key.size(); ++i ) {
+	hash = (hash ^ (unsigned char) key[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
 
-    return buf;
+// Can the driver save and load program binaries
+static bool
+hasProgramBinaries()
+{
+#ifdef GLEW_ARB_get_program_binary
+    GLint formatCount = 0;
+    if ( GLEW_ARB_get_program_binary ) {
+	glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount );
+    }
+    return formatCount > 0;
+#else
+    return false;
+#endif
 }
 
+// Load the program from its cache file if the file was made from the same
+// sources on the same driver. Returns false if it has to be compiled.
+static bool
+loadProgramBinary(GLuint program, const std::string& cacheFile, unsigned long long sourceHash)
+{
+#ifdef GLEW_ARB_get_program_binary
+    MappedFile file;
+    if ( !file.open(cacheFile.c_str()) || file.getSize() < sizeof(ProgramCacheHeader) ) {
+	return false;
+    }
+
+    ProgramCacheHeader header;
+    memcpy( &header, file.getData(), sizeof(ProgramCacheHeader) );
+    if ( memcmp(header.magic, "PGMB", 4) != 0 || header.sourceHash != sourceHash ||
+	 header.binaryLength != file.getSize() - sizeof(ProgramCacheHeader) ) {
+	return false;
+    }
+
+    // The driver can still turn the binary down, for example after an update
+    glProgramBinary( program, header.binaryFormat, file.getData() + sizeof(ProgramCacheHeader), (GLsizei) header.binaryLength );
+    GLint linked;
+    glGetProgramiv( program, GL_LINK_STATUS, &linked );
+    return linked == GL_TRUE;
+#else
+    return false;
+#endif
+}
+
+// Save a linked program so that the next launch can skip the compiler. A
+// cache that cannot be written only means compiling again next time.
+static void
+saveProgramBinary(GLuint program, const std::string& cacheFile, unsigned long long sourceHash)
+{
+#ifdef GLEW_ARB_get_program_binary
+    GLint length = 0;
+    glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+    if ( length <= 0 ) { return; }
+
+    ProgramCacheHeader header;
+    memset( &header, 0, sizeof(ProgramCacheHeader) );
+    memcpy( header.magic, "PGMB", 4 );
+    header.sourceHash = sourceHash;
+    std::vector<unsigned char> binary( length );
+    glGetProgramBinary( program, length, &length, &header.binaryFormat, binary.data() );
+    header.binaryLength = length;
+
+    FILE* fp = fopen( cacheFile.c_str(), "wb" );
+    if ( fp == NULL ) { return; }
+    bool written = fwrite( &header, sizeof(ProgramCacheHeader), 1, fp ) == 1 &&
+	fwrite( binary.data(), length, 1, fp ) == 1;
+    fclose( fp );
+    if ( !written ) {
+	remove( cacheFile.c_str() );
+    }
+#endif
+}
 
-// Create a GLSL program object from vertex and fragment shader files
+
+// Create a GLSL program object from vertex and fragment shader files. The
+// linked program is cached in a file named after both shader files, and
+// loaded from there while the sources and the driver stay the same.
 GLuint
 InitShader(const char* vShaderFile, const char* fShaderFile)
 {
     struct Shader {
 	const char*  filename;
 	GLenum       type;
-	GLchar*      source;
     }  shaders[2] = {
-	{ vShaderFile, GL_VERTEX_SHADER, NULL },
-	{ fShaderFile, GL_FRAGMENT_SHADER, NULL }
+	{ vShaderFile, GL_VERTEX_SHADER },
+	{ fShaderFile, GL_FRAGMENT_SHADER }
     };
 
-    GLuint program = glCreateProgram();
-    
+    std::string sources[2];
     for ( int i = 0; i < 2; ++i ) {
-	Shader& s = shaders[i];
-	s.source = readShaderSource( s.filename );
-	if ( shaders[i].source == NULL ) {
-	    std::cerr << "Failed to read " << s.filename << std::endl;
+	if ( !readShaderSource( shaders[i].filename, sources[i] ) ) {
+	    std::cerr << "Failed to read " << shaders[i].filename << std::endl;
 	    exit( EXIT_FAILURE );
 	}
+    }
+
+    GLuint program = glCreateProgram();
+
+    bool programBinaries = hasProgramBinaries();
+    std::string cacheFile = std::string( vShaderFile ) + "." + fShaderFile + ".program";
+    unsigned long long sourceHash = programBinaries ? hashProgramSources( sources ) : 0;
+    if ( programBinaries && loadProgramBinary( program, cacheFile, sourceHash ) ) {
+	glUseProgram( program );
+	return program;
+    }
+
+    GLuint shaderObjects[2];
+    for ( int i = 0; i < 2; ++i ) {
+	Shader& s = shaders[i];
+	const GLchar* source = sources[i].c_str();
 
 	GLuint shader = glCreateShader( s.type );
-	glShaderSource( shader, 1, (const GLchar**) &s.source, NULL );
+	glShaderSource( shader, 1, &source, NULL );
 	glCompileShader( shader );
 
 	GLint  compiled;
@@ -66,12 +178,16 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 	    exit( EXIT_FAILURE );
 	}
 
-	delete [] s.source;
-
 	glAttachShader( program, shader );
+	shaderObjects[i] = shader;
     }
 
     /* link  and error check */
+#ifdef GLEW_ARB_get_program_binary
+    if ( programBinaries ) {
+	glProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+    }
+#endif
     glLinkProgram(program);
 
     GLint  linked;
@@ -88,6 +204,16 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 	exit( EXIT_FAILURE );
     }
 
+    // The program keeps what it needs from the shaders once it is linked
+    for ( int i = 0; i < 2; ++i ) {
+	glDetachShader( program, shaderObjects[i] );
+	glDeleteShader( shaderObjects[i] );
+    }
+
+    if ( programBinaries ) {
+	saveProgramBinary( program, cacheFile, sourceHash );
+    }
+
     /* use program object */
     glUseProgram(program);
 
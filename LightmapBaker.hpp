@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <vector>
+#include "TiledHeightMap.hpp"
+
+//This class bakes ambient occlusion and sun shadows of a heightmap into a lightmap with one texel per height. Both come from
+//horizon angles: how high the terrain rises above each height when looking in a direction. The horizons are found with line
+//sweeps. For each direction the heightmap is crossed by parallel lines, and along each line the upper convex hull of the heights
+//passed so far gives the horizon of the next height in constant time on average, so a direction costs O(N^2) for the whole map.
+//Each texel holds the ambient light that is not occluded in red and the sunlight that is not shadowed in green, from 0 to 255.
+class LightmapBaker {
+
+private:
+
+	//Number of directions averaged for ambient occlusion
+	static const unsigned int DIRECTION_COUNT = 16;
+
+	//Height a known distance along a sweep line
+	struct HullPoint {
+		float distance, height;
+	};
+
+	//Sweep the lines from the first to the last one in a direction given in columns and rows. The direction has been scaled so
+	//that its longer component is 1, which makes every line visit one cell of each row or column it crosses. The slope of the
+	//horizon seen looking back along the line is written for every cell the lines visit.
+	static void sweepLines(const TiledHeightMap& heightMap, float columnStep, float rowStep, int firstLine, int lastLine, float* horizonSlopes) {
+
+		int dimension = heightMap.getDimension();
+		bool columnMajor = std::abs(columnStep) >= std::abs(rowStep);
+		float minorStep = columnMajor ? rowStep : columnStep;
+		int majorStart = (columnMajor ? columnStep : rowStep) > 0.0 ? 0 : dimension - 1, majorDirection = majorStart == 0 ? 1 : -1;
+
+		//Heights are in model units and one cell is 2 / dimension of them across
+		float stepLength = std::sqrt(1.0f + minorStep * minorStep) * 2.0f / dimension;
+		std::vector<HullPoint> hull;
+
+		for (int line = firstLine; line <= lastLine; ++line) {
+			hull.clear();
+			for (int step = 0; step < dimension; ++step) {
+
+				int major = majorStart + step * majorDirection, minor = line + (int)std::floor(step * minorStep + 0.5f);
+				if (minor < 0 || minor >= dimension) {
+					continue;
+				}
+				int row = columnMajor ? minor : major, column = columnMajor ? major : minor;
+				HullPoint point = { step * stepLength, heightMap.get(row, column) };
+
+				//Drop the points that are no longer on the upper hull. The last point left is then the highest one seen from here.
+				while (hull.size() >= 2 && (hull.back().height - point.height) * (point.distance - hull[hull.size() - 2].distance) <=
+					(hull[hull.size() - 2].height - point.height) * (point.distance - hull.back().distance)) {
+					hull.pop_back();
+				}
+				horizonSlopes[(size_t)row * dimension + column] = hull.empty() ? -std::numeric_limits<float>::max() :
+					(hull.back().height - point.height) / (point.distance - hull.back().distance);
+				hull.push_back(point);
+			}
+		}
+	}
+
+	//Find the horizon slopes looking toward a direction given in columns and rows, sweeping the lines on several threads.
+	//Lines do not share cells, so the threads write different slopes.
+	static void findHorizons(const TiledHeightMap& heightMap, float towardColumn, float towardRow, std::vector<float>& horizonSlopes) {
+
+		//The sweep moves away from the direction looked toward
+		float scale = 1.0f / std::max(std::abs(towardColumn), std::abs(towardRow));
+		float columnStep = -towardColumn * scale, rowStep = -towardRow * scale;
+		float minorStep = std::abs(columnStep) >= std::abs(rowStep) ? rowStep : columnStep;
+
+		//Lines start on the leading edge and drift sideways by the minor step for every cell, so some start off the heightmap
+		int dimension = heightMap.getDimension(), drift = (int)std::ceil(std::abs(minorStep) * (dimension - 1)) + 1;
+		int firstLine = minorStep > 0.0 ? -drift : 0, lastLine = minorStep > 0.0 ? dimension - 1 : dimension - 1 + drift;
+
+		int threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		int bandLines = (lastLine - firstLine + threadCount) / threadCount;
+		std::vector<std::thread> threads;
+		for (int bandFirstLine = firstLine; bandFirstLine <= lastLine; bandFirstLine += bandLines) {
+			threads.push_back(std::thread(sweepLines, std::cref(heightMap), columnStep, rowStep, bandFirstLine,
+				std::min(bandFirstLine + bandLines - 1, lastLine), horizonSlopes.data()));
+		}
+		for (unsigned int threadCounter = 0; threadCounter < threads.size(); ++threadCounter) {
+			threads[threadCounter].join();
+		}
+	}
+
+public:
+
+	//Bake the lightmap of the heightmap for a sun in the given direction in model coordinates, where x follows the columns and
+	//z the rows. The lightmap gets two bytes for every height, one row after the other.
+	static void bake(const TiledHeightMap& heightMap, float sunX, float sunY, float sunZ, std::vector<unsigned char>& lightmap) {
+
+		unsigned int dimension = heightMap.getDimension();
+		size_t heightCount = (size_t)dimension * dimension;
+		std::vector<float> horizonSlopes(heightCount), occlusion(heightCount, 0.0);
+
+		//The occlusion in a direction is the sine of the horizon angle when the horizon is above the height
+		const float PI = 3.14159265f;
+		for (unsigned int direction = 0; direction < DIRECTION_COUNT; ++direction) {
+			float angle = 2.0f * PI * direction / DIRECTION_COUNT;
+			findHorizons(heightMap, std::cos(angle), std::sin(angle), horizonSlopes);
+			for (size_t height = 0; height < heightCount; ++height) {
+				float slope = horizonSlopes[height];
+				if (slope > 0.0) {
+					occlusion[height] += slope / std::sqrt(1.0f + slope * slope);
+				}
+			}
+		}
+
+		//A height is in sunlight when its horizon toward the sun is below the sun
+		float sunDistance = std::sqrt(sunX * sunX + sunZ * sunZ);
+		if (sunDistance > 0.0) {
+			findHorizons(heightMap, sunX, sunZ, horizonSlopes);
+		}
+		else {
+			std::fill(horizonSlopes.begin(), horizonSlopes.end(), -std::numeric_limits<float>::max());
+		}
+		float sunSlope = sunDistance > 0.0 ? sunY / sunDistance : std::numeric_limits<float>::max();
+
+		//Shadows fade in over this difference between the sun slope and the horizon slope, so that their edges are soft
+		const float PENUMBRA_SLOPE = 0.05f;
+		lightmap.resize(2 * heightCount);
+		for (size_t height = 0; height < heightCount; ++height) {
+			float ambient = 1.0f - occlusion[height] / DIRECTION_COUNT;
+			float sunlight = std::min(std::max((sunSlope - horizonSlopes[height]) / PENUMBRA_SLOPE + 0.5f, 0.0f), 1.0f);
+			lightmap[2 * height] = (unsigned char)(ambient * 255.0f + 0.5f);
+			lightmap[2 * height + 1] = (unsigned char)(sunlight * 255.0f + 0.5f);
+		}
+	}
+
+};
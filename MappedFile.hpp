@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//This class maps a file into memory for reading. The bytes are paged in from the file as they are read, so nothing is copied
+//into a buffer of our own and a large file costs no more memory than the parts that are used.
+class MappedFile {
+
+private:
+
+	const unsigned char* data;
+	size_t size;
+
+#ifdef _WIN32
+	HANDLE file, mapping;
+#else
+	int file;
+#endif
+
+	//A mapping belongs to one object
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+
+	//Constructor for a file that has not been opened
+	MappedFile() {
+		this->data = NULL;
+		this->size = 0;
+#ifdef _WIN32
+		this->file = INVALID_HANDLE_VALUE;
+		this->mapping = NULL;
+#else
+		this->file = -1;
+#endif
+	}
+
+	~MappedFile() {
+		close();
+	}
+
+	//Map a file. Returns false if it cannot be opened or is empty.
+	bool open(const char* fileName) {
+
+		close();
+
+#ifdef _WIN32
+		this->file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		LARGE_INTEGER fileSize;
+		if (this->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(this->file, &fileSize) || fileSize.QuadPart == 0) {
+			close();
+			return false;
+		}
+		this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		this->data = this->mapping == NULL ? NULL : (const unsigned char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+		this->size = (size_t)fileSize.QuadPart;
+#else
+		this->file = ::open(fileName, O_RDONLY);
+		struct stat fileStatus;
+		if (this->file < 0 || fstat(this->file, &fileStatus) != 0 || fileStatus.st_size == 0) {
+			close();
+			return false;
+		}
+		this->size = (size_t)fileStatus.st_size;
+		void* mapped = mmap(NULL, this->size, PROT_READ, MAP_PRIVATE, this->file, 0);
+		this->data = mapped == MAP_FAILED ? NULL : (const unsigned char*)mapped;
+#endif
+
+		if (this->data == NULL) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	//Unmap the file
+	void close() {
+
+#ifdef _WIN32
+		if (this->data != NULL) {
+			UnmapViewOfFile(this->data);
+		}
+		if (this->mapping != NULL) {
+			CloseHandle(this->mapping);
+		}
+		if (this->file != INVALID_HANDLE_VALUE) {
+			CloseHandle(this->file);
+		}
+		this->file = INVALID_HANDLE_VALUE;
+		this->mapping = NULL;
+#else
+		if (this->data != NULL) {
+			munmap((void*)this->data, this->size);
+		}
+		if (this->file >= 0) {
+			::close(this->file);
+		}
+		this->file = -1;
+#endif
+		this->data = NULL;
+		this->size = 0;
+	}
+
+	bool isOpen() const {
+		return this->data != NULL;
+	}
+
+	const unsigned char* getData() const {
+		return this->data;
+	}
+
+	size_t getSize() const {
+		return this->size;
+	}
+
+};
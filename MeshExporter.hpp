@@ -0,0 +1,373 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "HeightBandSink.hpp"
+#include "TiledHeightMap.hpp"
+
+//This class writes the full resolution mesh of a heightmap as binary glTF or binary PLY for other tools. The mesh is streamed
+//straight from the heightmap a row at a time: each row of vertices only needs the rows next to it for its normals, and the
+//triangles follow from the dimension. Everything goes out through one buffer of a fixed size, so the memory used is the same
+//whatever the size of the terrain. The vertices and triangles are the ones the viewer draws for the full resolution mesh.
+//BandWriter writes the same files from heights that come a band of rows at a time, for terrains that are never held whole.
+class MeshExporter {
+
+private:
+
+	//Size of the buffer the file is written through
+	static const unsigned int BUFFER_BYTES = 1 << 22;
+
+	//Bytes of a vertex, which is a position followed by a normal
+	static const unsigned int VERTEX_BYTES = 6 * sizeof(float);
+
+	//Writes a file through a buffer of a fixed size, remembering whether any write failed
+	class BufferedFile {
+
+	private:
+
+		FILE* file;
+		std::vector<unsigned char> buffer;
+		size_t usedBytes;
+		bool failed;
+
+	public:
+
+		BufferedFile(const std::string& fileName) : buffer(BUFFER_BYTES) {
+			this->file = fopen(fileName.c_str(), "wb");
+			this->usedBytes = 0;
+			this->failed = this->file == NULL;
+		}
+
+		~BufferedFile() {
+			close();
+		}
+
+		void write(const void* data, size_t byteCount) {
+
+			const unsigned char* bytes = (const unsigned char*)data;
+			while (byteCount > 0 && !this->failed) {
+				size_t copiedBytes = std::min(byteCount, this->buffer.size() - this->usedBytes);
+				std::memcpy(&this->buffer[this->usedBytes], bytes, copiedBytes);
+				this->usedBytes += copiedBytes;
+				bytes += copiedBytes;
+				byteCount -= copiedBytes;
+				if (this->usedBytes == this->buffer.size()) {
+					flush();
+				}
+			}
+		}
+
+		void flush() {
+			if (!this->failed && this->usedBytes > 0) {
+				this->failed = fwrite(this->buffer.data(), this->usedBytes, 1, this->file) != 1;
+			}
+			this->usedBytes = 0;
+		}
+
+		//Write what is left in the buffer and close the file. Returns false if anything could not be written.
+		bool close() {
+
+			if (this->file == NULL) {
+				return false;
+			}
+			flush();
+			this->failed = fclose(this->file) != 0 || this->failed;
+			this->file = NULL;
+			return !this->failed;
+		}
+
+	};
+
+	//Writes the vertices a row of heights at a time. Each row of vertices needs the rows above and below it for its normals, so
+	//it is written when the row below it comes in, and the last row when there are no more.
+	class VertexWriter {
+
+	private:
+
+		unsigned int dimension, addedRows;
+		float stepValue;
+		std::vector<float> above, heights, below, vertices;
+
+		//Write the vertices of the current row. The rows above and below are given with the number of rows between them.
+		void writeRow(const std::vector<float>& rowAbove, const std::vector<float>& rowBelow, unsigned int rowSpan, BufferedFile& file) {
+
+			unsigned int row = this->addedRows - 1;
+			for (unsigned int column = 0; column < this->dimension; ++column) {
+				unsigned int left = column > 0 ? column - 1 : column, right = column < this->dimension - 1 ? column + 1 : column;
+				float xSlope = (this->heights[right] - this->heights[left]) / ((right - left) * this->stepValue);
+				float zSlope = (rowBelow[column] - rowAbove[column]) / (rowSpan * this->stepValue);
+				float inverseLength = 1.0f / std::sqrt(xSlope * xSlope + 1.0f + zSlope * zSlope);
+
+				float* vertex = &this->vertices[6 * column];
+				vertex[0] = -1.0f + column * this->stepValue;
+				vertex[1] = this->heights[column];
+				vertex[2] = -1.0f + row * this->stepValue;
+				vertex[3] = -xSlope * inverseLength;
+				vertex[4] = inverseLength;
+				vertex[5] = -zSlope * inverseLength;
+			}
+			file.write(this->vertices.data(), this->vertices.size() * sizeof(float));
+		}
+
+	public:
+
+		VertexWriter(unsigned int dimension) : above(dimension), heights(dimension), below(dimension), vertices(6 * dimension) {
+			this->dimension = dimension;
+			this->addedRows = 0;
+			this->stepValue = 2.0f / dimension;
+		}
+
+		//Take the next row of heights, which writes the vertices of the row before it
+		void addRow(const float* rowHeights, BufferedFile& file) {
+
+			std::copy(rowHeights, rowHeights + this->dimension, this->below.begin());
+			if (this->addedRows > 1) {
+				writeRow(this->above, this->below, 2, file);
+			}
+			else if (this->addedRows == 1) {
+				writeRow(this->heights, this->below, 1, file);
+			}
+
+			//Move the rows up by one
+			this->above.swap(this->heights);
+			this->heights.swap(this->below);
+			++this->addedRows;
+		}
+
+		//Write the vertices of the last row
+		void finish(BufferedFile& file) {
+			writeRow(this->addedRows > 1 ? this->above : this->heights, this->heights, this->addedRows > 1 ? 1 : 0, file);
+		}
+
+	};
+
+	//Write the vertices of every row
+	static void writeVertices(const TiledHeightMap& heightMap, BufferedFile& file) {
+
+		unsigned int dimension = heightMap.getDimension();
+		VertexWriter vertexWriter(dimension);
+		std::vector<float> heights(dimension);
+		for (unsigned int row = 0; row < dimension; ++row) {
+			heightMap.getRow(row, 0, dimension, heights.data());
+			vertexWriter.addRow(heights.data(), file);
+		}
+		vertexWriter.finish(file);
+	}
+
+	//Write the two triangles of every cell one row of cells at a time. PLY faces start with their vertex count.
+	static void writeTriangles(unsigned int dimension, bool withVertexCounts, BufferedFile& file) {
+
+		std::vector<unsigned char> cellRow;
+		unsigned char vertexCount = 3;
+		for (unsigned int row = 0; row + 1 < dimension; ++row) {
+			cellRow.clear();
+			for (unsigned int column = 0; column + 1 < dimension; ++column) {
+				unsigned int currentVertex = row * dimension + column, nextVertex = currentVertex + 1;
+				unsigned int vertexBelow = currentVertex + dimension, afterVertexBelow = vertexBelow + 1;
+				unsigned int triangles[2][3] = { { currentVertex, vertexBelow, afterVertexBelow }, { currentVertex, afterVertexBelow, nextVertex } };
+				for (unsigned int triangle = 0; triangle < 2; ++triangle) {
+					if (withVertexCounts) {
+						cellRow.push_back(vertexCount);
+					}
+					const unsigned char* indexBytes = (const unsigned char*)triangles[triangle];
+					cellRow.insert(cellRow.end(), indexBytes, indexBytes + sizeof(triangles[triangle]));
+				}
+			}
+			file.write(cellRow.data(), cellRow.size());
+		}
+	}
+
+	//Find the lowest and highest heights, which glTF needs before the vertices
+	static void findHeightRange(const TiledHeightMap& heightMap, float& minHeight, float& maxHeight) {
+
+		unsigned int dimension = heightMap.getDimension();
+		std::vector<float> heights(dimension);
+		minHeight = std::numeric_limits<float>::max();
+		maxHeight = -std::numeric_limits<float>::max();
+		for (unsigned int row = 0; row < dimension; ++row) {
+			heightMap.getRow(row, 0, dimension, heights.data());
+			minHeight = std::min(minHeight, *std::min_element(heights.begin(), heights.end()));
+			maxHeight = std::max(maxHeight, *std::max_element(heights.begin(), heights.end()));
+		}
+	}
+
+	//Get everything a PLY file has before its vertices. Returns false if the mesh has too many vertices for 32 bit indices.
+	static bool getPlyHeader(unsigned int dimension, std::string& headerBytes) {
+
+		if ((unsigned long long)dimension * dimension > std::numeric_limits<unsigned int>::max()) {
+			return false;
+		}
+
+		std::stringstream header;
+		header << "ply\n" << "format binary_little_endian 1.0\n" << "comment Terrain heightmap of dimension " << dimension << "\n" <<
+			"element vertex " << (unsigned long long)dimension * dimension << "\n" <<
+			"property float x\n" << "property float y\n" << "property float z\n" <<
+			"property float nx\n" << "property float ny\n" << "property float nz\n" <<
+			"element face " << 2ULL * (dimension - 1) * (dimension - 1) << "\n" <<
+			"property list uchar uint vertex_indices\n" << "end_header\n";
+		headerBytes = header.str();
+		return true;
+	}
+
+	//Get everything a GLB file has before its vertices: the file header, the JSON chunk and the header of the binary chunk.
+	//Returns false if the file would be larger than the 4 GB a GLB file can hold.
+	static bool getGlbHeader(unsigned int dimension, float minHeight, float maxHeight, std::string& headerBytes) {
+
+		unsigned long long vertexCount = (unsigned long long)dimension * dimension, indexCount = 6ULL * (dimension - 1) * (dimension - 1);
+		unsigned long long vertexBytes = vertexCount * VERTEX_BYTES, binaryBytes = vertexBytes + indexCount * sizeof(unsigned int);
+		float stepValue = 2.0f / dimension, maxCoordinate = -1.0f + (dimension - 1) * stepValue;
+
+		std::stringstream json;
+		json << std::setprecision(9) <<
+			"{\"asset\":{\"version\":\"2.0\",\"generator\":\"TerrainGeneration\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}]," <<
+			"\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1},\"indices\":2}]}]," <<
+			"\"buffers\":[{\"byteLength\":" << binaryBytes << "}]," <<
+			"\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << vertexBytes << ",\"byteStride\":" << VERTEX_BYTES << ",\"target\":34962}," <<
+			"{\"buffer\":0,\"byteOffset\":" << vertexBytes << ",\"byteLength\":" << binaryBytes - vertexBytes << ",\"target\":34963}]," <<
+			"\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,\"count\":" << vertexCount << ",\"type\":\"VEC3\"," <<
+			"\"min\":[-1," << minHeight << ",-1],\"max\":[" << maxCoordinate << "," << maxHeight << "," << maxCoordinate << "]}," <<
+			"{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,\"count\":" << vertexCount << ",\"type\":\"VEC3\"}," <<
+			"{\"bufferView\":1,\"byteOffset\":0,\"componentType\":5125,\"count\":" << indexCount << ",\"type\":\"SCALAR\"}]}";
+
+		//Chunks are padded to four bytes, the JSON with spaces
+		std::string jsonText = json.str();
+		jsonText.resize((jsonText.size() + 3) / 4 * 4, ' ');
+		unsigned long long fileBytes = 12 + 8 + jsonText.size() + 8 + binaryBytes;
+		if (fileBytes > std::numeric_limits<unsigned int>::max() || vertexCount > std::numeric_limits<unsigned int>::max()) {
+			return false;
+		}
+
+		unsigned int fileHeader[3] = { 0x46546C67, 2, (unsigned int)fileBytes };
+		unsigned int jsonHeader[2] = { (unsigned int)jsonText.size(), 0x4E4F534A };
+		unsigned int binaryHeader[2] = { (unsigned int)binaryBytes, 0x004E4942 };
+		headerBytes.assign((const char*)fileHeader, sizeof(fileHeader));
+		headerBytes.append((const char*)jsonHeader, sizeof(jsonHeader));
+		headerBytes.append(jsonText);
+		headerBytes.append((const char*)binaryHeader, sizeof(binaryHeader));
+		return true;
+	}
+
+public:
+
+	//Writes the mesh of heights that come a band of rows at a time. A GLB file needs the range of the heights before the
+	//vertices, so it has to be given, for example from TerrainStreamer::findHeightRange.
+	class BandWriter : public HeightBandSink {
+
+	private:
+
+		std::string fileName;
+		BufferedFile file;
+		VertexWriter vertexWriter;
+		unsigned int dimension, takenRows;
+		bool isGlb, failed;
+
+		//A file belongs to one writer
+		BandWriter(const BandWriter&);
+		BandWriter& operator=(const BandWriter&);
+
+	public:
+
+		//Constructor for a PLY file
+		BandWriter(const std::string& fileName, unsigned int dimension) : file(fileName), vertexWriter(dimension) {
+
+			std::string headerBytes;
+			this->fileName = fileName;
+			this->dimension = dimension;
+			this->takenRows = 0;
+			this->isGlb = false;
+			this->failed = !getPlyHeader(dimension, headerBytes);
+			this->file.write(headerBytes.data(), headerBytes.size());
+		}
+
+		//Constructor for a GLB file whose heights go from the lowest to the highest height given
+		BandWriter(const std::string& fileName, unsigned int dimension, float minHeight, float maxHeight) : file(fileName), vertexWriter(dimension) {
+
+			std::string headerBytes;
+			this->fileName = fileName;
+			this->dimension = dimension;
+			this->takenRows = 0;
+			this->isGlb = true;
+			this->failed = !getGlbHeader(dimension, minHeight, maxHeight, headerBytes);
+			this->file.write(headerBytes.data(), headerBytes.size());
+		}
+
+		bool takeBand(unsigned int firstRow, unsigned int rowCount, const float* heights) {
+
+			if (firstRow != this->takenRows || rowCount > this->dimension - firstRow) {
+				this->failed = true;
+			}
+			for (unsigned int row = 0; row < rowCount && !this->failed; ++row) {
+				this->vertexWriter.addRow(heights + (size_t)row * this->dimension, this->file);
+			}
+			this->takenRows += rowCount;
+			return !this->failed;
+		}
+
+		//The triangles follow from the dimension, so they go out once the last vertices have
+		bool finish() {
+
+			if (!this->failed && this->takenRows == this->dimension) {
+				this->vertexWriter.finish(this->file);
+				writeTriangles(this->dimension, !this->isGlb, this->file);
+			}
+			else {
+				this->failed = true;
+			}
+			if (!this->file.close() || this->failed) {
+				remove(this->fileName.c_str());
+				return false;
+			}
+			return true;
+		}
+
+	};
+
+	//Write the mesh as binary PLY. Returns false if the file cannot be written or has too many vertices for 32 bit indices.
+	static bool exportPly(const TiledHeightMap& heightMap, const std::string& fileName) {
+
+		std::string headerBytes;
+		if (!getPlyHeader(heightMap.getDimension(), headerBytes)) {
+			return false;
+		}
+
+		BufferedFile file(fileName);
+		file.write(headerBytes.data(), headerBytes.size());
+		writeVertices(heightMap, file);
+		writeTriangles(heightMap.getDimension(), true, file);
+		if (!file.close()) {
+			remove(fileName.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	//Write the mesh as binary glTF (GLB). The vertices are interleaved in one buffer view and the triangles use 32 bit indices.
+	//Returns false if the file cannot be written or would be larger than the 4 GB a GLB file can hold.
+	static bool exportGlb(const TiledHeightMap& heightMap, const std::string& fileName) {
+
+		float minHeight, maxHeight;
+		findHeightRange(heightMap, minHeight, maxHeight);
+		std::string headerBytes;
+		if (!getGlbHeader(heightMap.getDimension(), minHeight, maxHeight, headerBytes)) {
+			return false;
+		}
+
+		BufferedFile file(fileName);
+		file.write(headerBytes.data(), headerBytes.size());
+		writeVertices(heightMap, file);
+		writeTriangles(heightMap.getDimension(), false, file);
+		if (!file.close()) {
+			remove(fileName.c_str());
+			return false;
+		}
+		return true;
+	}
+
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include "HeightPyramid.hpp"
+#include "TiledHeightMap.hpp"
+
+//This class bakes the normals of a heightmap into an object space normal map with one texel per height, so that a mesh with
+//fewer vertices than the heightmap can still be lit at full resolution. The normals are found from the slopes between the
+//neighboring heights the same way as the vertex normals. Each texel holds x, y and z mapped from -1..1 to 0..255, and 255 in
+//alpha. Large areas are split into bands of rows baked on separate threads, and four normals are normalized at a time with SSE.
+class NormalMapBaker {
+
+private:
+
+	//Smallest number of texels worth giving a thread of its own
+	static const unsigned int TEXELS_PER_THREAD = 65536;
+
+	//Store a normal in a texel
+	static void writeTexel(float x, float y, float z, unsigned char* texel) {
+
+		texel[0] = (unsigned char)(x * 127.5 + 128.0);
+		texel[1] = (unsigned char)(y * 127.5 + 128.0);
+		texel[2] = (unsigned char)(z * 127.5 + 128.0);
+		texel[3] = 255;
+	}
+
+	//Bake the normal of one height from its slopes. The slopes are scaled by the distance between the neighbors used, which is
+	//shorter on the edges of the heightmap.
+	static void bakeTexel(const float* heights, const float* above, const float* below, unsigned int column, unsigned int dimension,
+		float zScale, unsigned char* texel) {
+
+		unsigned int left = column > 0 ? column - 1 : column, right = column < dimension - 1 ? column + 1 : column;
+		float xSlope = (heights[right] - heights[left]) * (dimension / (2.0f * (right - left)));
+		float zSlope = (below[column] - above[column]) * zScale;
+		float inverseLength = 1.0f / std::sqrt(xSlope * xSlope + 1.0f + zSlope * zSlope);
+		writeTexel(-xSlope * inverseLength, inverseLength, -zSlope * inverseLength, texel);
+	}
+
+	//Bake a band of rows of the area. The texels are written one row of the area after the other.
+	static void bakeRows(const TiledHeightMap& heightMap, unsigned int firstRow, unsigned int lastRow, unsigned int firstColumn,
+		unsigned int lastColumn, unsigned char* normalMap) {
+
+		unsigned int dimension = heightMap.getDimension(), columnCount = lastColumn - firstColumn + 1;
+		std::vector<float> heights(dimension), above(dimension), below(dimension);
+
+		//Rows are read from one column before the area to one column after it, where the heightmap has them
+		unsigned int readFirstColumn = firstColumn > 0 ? firstColumn - 1 : 0, readLastColumn = std::min(lastColumn + 1, dimension - 1);
+		unsigned int readCount = readLastColumn - readFirstColumn + 1;
+
+		for (unsigned int row = firstRow; row <= lastRow; ++row) {
+
+			unsigned int aboveRow = row > 0 ? row - 1 : row, belowRow = row < dimension - 1 ? row + 1 : row;
+			heightMap.getRow(row, readFirstColumn, readCount, &heights[readFirstColumn]);
+			heightMap.getRow(aboveRow, readFirstColumn, readCount, &above[readFirstColumn]);
+			heightMap.getRow(belowRow, readFirstColumn, readCount, &below[readFirstColumn]);
+			float zScale = dimension / (2.0f * (belowRow - aboveRow));
+			unsigned char* texels = normalMap + 4 * (size_t)(row - firstRow) * columnCount;
+
+			//The edge columns have their neighbor on one side only
+			unsigned int column = firstColumn;
+			if (column == 0) {
+				bakeTexel(heights.data(), above.data(), below.data(), column, dimension, zScale, texels);
+				++column;
+			}
+
+#ifdef TERRAIN_USE_SSE
+			//Inner columns four at a time
+			__m128 xScales = _mm_set1_ps(dimension / 4.0f), zScales = _mm_set1_ps(zScale), ones = _mm_set1_ps(1.0);
+			__m128 signMask = _mm_set1_ps(-0.0f);
+			float normals[3][4];
+			for (; column + 4 <= std::min(lastColumn + 1, dimension - 1); column += 4) {
+				__m128 xSlopes = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&heights[column + 1]), _mm_loadu_ps(&heights[column - 1])), xScales);
+				__m128 zSlopes = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&below[column]), _mm_loadu_ps(&above[column])), zScales);
+
+				//The same operations as for a single texel, so that rebaking part of the map gives the same texels
+				__m128 inverseLengths = _mm_div_ps(ones, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(xSlopes, xSlopes), ones), _mm_mul_ps(zSlopes, zSlopes))));
+				_mm_storeu_ps(normals[0], _mm_xor_ps(_mm_mul_ps(xSlopes, inverseLengths), signMask));
+				_mm_storeu_ps(normals[1], inverseLengths);
+				_mm_storeu_ps(normals[2], _mm_xor_ps(_mm_mul_ps(zSlopes, inverseLengths), signMask));
+				for (unsigned int lane = 0; lane < 4; ++lane) {
+					writeTexel(normals[0][lane], normals[1][lane], normals[2][lane], texels + 4 * (column + lane - firstColumn));
+				}
+			}
+#endif
+
+			for (; column <= lastColumn; ++column) {
+				bakeTexel(heights.data(), above.data(), below.data(), column, dimension, zScale, texels + 4 * (column - firstColumn));
+			}
+		}
+	}
+
+public:
+
+	//Bake the normals of the heights from the first to the last row and column into the normal map, which needs four bytes
+	//for every height in the area. The texels are written one row of the area after the other.
+	static void bake(const TiledHeightMap& heightMap, unsigned int firstRow, unsigned int firstColumn, unsigned int lastRow,
+		unsigned int lastColumn, unsigned char* normalMap) {
+
+		unsigned int rowCount = lastRow - firstRow + 1, columnCount = lastColumn - firstColumn + 1;
+		unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		threadCount = (unsigned int)std::max(std::min((size_t)threadCount, (size_t)rowCount * columnCount / TEXELS_PER_THREAD), (size_t)1);
+
+		//Every thread bakes a band of rows. This thread bakes the last band.
+		std::vector<std::thread> threads;
+		unsigned int bandRows = (rowCount + threadCount - 1) / threadCount;
+		for (unsigned int bandFirstRow = firstRow; bandFirstRow <= lastRow; bandFirstRow += bandRows) {
+			unsigned int bandLastRow = std::min(bandFirstRow + bandRows - 1, lastRow);
+			unsigned char* bandNormals = normalMap + 4 * (size_t)(bandFirstRow - firstRow) * columnCount;
+			if (bandLastRow == lastRow) {
+				bakeRows(heightMap, bandFirstRow, bandLastRow, firstColumn, lastColumn, bandNormals);
+			}
+			else {
+				threads.push_back(std::thread(bakeRows, std::cref(heightMap), bandFirstRow, bandLastRow, firstColumn, lastColumn, bandNormals));
+			}
+		}
+		for (unsigned int threadCounter = 0; threadCounter < threads.size(); ++threadCounter) {
+			threads[threadCounter].join();
+		}
+	}
+
+	//Bake the normals of the whole heightmap
+	static void bake(const TiledHeightMap& heightMap, std::vector<unsigned char>& normalMap) {
+
+		unsigned int dimension = heightMap.getDimension();
+		normalMap.resize(4 * (size_t)dimension * dimension);
+		bake(heightMap, 0, 0, dimension - 1, dimension - 1, normalMap.data());
+	}
+
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+//This class builds an adaptive mesh for a heightmap using a right-triangulated irregular network (RTIN). The heightmap is split
+//into two right triangles that are recursively bisected along their hypotenuse. A triangle is only split if the height at the middle
+//of its hypotenuse differs from the interpolated height by more than the allowed error. This needs a 2^n+1 heightmap.
+class RtinMesher {
+
+private:
+
+	unsigned int terrainDimension;
+
+	//Heightmap the mesh is built from
+	const std::vector<float>& heightMap;
+
+	//Largest error of any triangle that has this vertex at the middle of its hypotenuse, including all its child triangles
+	std::vector<float> vertexErrors;
+
+	//Find the two ends of the hypotenuse of a triangle from its index in the implicit binary tree of triangles
+	void getHypotenuseEnds(unsigned int triangleIndex, int& aColumn, int& aRow, int& bColumn, int& bRow) {
+
+		int tileSize = this->terrainDimension - 1, cColumn = 0, cRow = 0;
+		unsigned int id = triangleIndex + 2;
+
+		aColumn = aRow = bColumn = bRow = 0;
+		if (id & 1) {//bottom left triangle
+			bColumn = bRow = cColumn = tileSize;
+		}
+		else {//top right triangle
+			aColumn = aRow = cRow = tileSize;
+		}
+
+		//Walk down the tree choosing the left or right half of the triangle
+		while ((id >>= 1) > 1) {
+			int middleColumn = (aColumn + bColumn) >> 1, middleRow = (aRow + bRow) >> 1;
+			if (id & 1) {//left half
+				bColumn = aColumn;
+				bRow = aRow;
+				aColumn = cColumn;
+				aRow = cRow;
+			}
+			else {//right half
+				aColumn = bColumn;
+				aRow = bRow;
+				bColumn = cColumn;
+				bRow = cRow;
+			}
+			cColumn = middleColumn;
+			cRow = middleRow;
+		}
+	}
+
+	//Compute the error at each vertex bottom-up, starting from the smallest triangles so that children are done before parents
+	void computeVertexErrors() {
+
+		unsigned int tileSize = this->terrainDimension - 1;
+		unsigned int numberOfSmallestTriangles = tileSize * tileSize;
+		unsigned int numberOfTriangles = numberOfSmallestTriangles * 2 - 2;
+		unsigned int lastLevelIndex = numberOfTriangles - numberOfSmallestTriangles;
+
+		int aColumn, aRow, bColumn, bRow;
+		for (long triangleCounter = (long)numberOfTriangles - 1; triangleCounter >= 0; --triangleCounter) {
+
+			getHypotenuseEnds(triangleCounter, aColumn, aRow, bColumn, bRow);
+			int middleColumn = (aColumn + bColumn) >> 1, middleRow = (aRow + bRow) >> 1;
+			int cColumn = middleColumn + middleRow - aRow, cRow = middleRow + aColumn - middleColumn;
+
+			//Error of this triangle is the difference between the actual and interpolated height at the middle of the hypotenuse
+			float interpolatedHeight = (this->heightMap[getLocationOffset(aRow, aColumn)] + this->heightMap[getLocationOffset(bRow, bColumn)]) / 2.0f;
+			unsigned int middleOffset = getLocationOffset(middleRow, middleColumn);
+			float middleError = std::abs(interpolatedHeight - this->heightMap[middleOffset]);
+			this->vertexErrors[middleOffset] = std::max(this->vertexErrors[middleOffset], middleError);
+
+			//Bigger triangles also carry the error of their two children
+			if ((unsigned int)triangleCounter < lastLevelIndex) {
+				unsigned int leftChildOffset = getLocationOffset((aRow + cRow) >> 1, (aColumn + cColumn) >> 1);
+				unsigned int rightChildOffset = getLocationOffset((bRow + cRow) >> 1, (bColumn + cColumn) >> 1);
+				this->vertexErrors[middleOffset] = std::max(this->vertexErrors[middleOffset],
+					std::max(this->vertexErrors[leftChildOffset], this->vertexErrors[rightChildOffset]));
+			}
+		}
+	}
+
+	//Split the triangle if its error is too large, otherwise add it to the mesh. The vertices are given in counter clockwise order
+	//looking down on the terrain and the right angle is at vertex c.
+	void addTriangle(int aColumn, int aRow, int bColumn, int bRow, int cColumn, int cRow, float maxError, std::vector<int>& indices) {
+
+		int middleColumn = (aColumn + bColumn) >> 1, middleRow = (aRow + bRow) >> 1;
+		if (std::abs(aColumn - cColumn) + std::abs(aRow - cRow) > 1 && this->vertexErrors[getLocationOffset(middleRow, middleColumn)] > maxError) {
+			addTriangle(cColumn, cRow, aColumn, aRow, middleColumn, middleRow, maxError, indices);
+			addTriangle(bColumn, bRow, cColumn, cRow, middleColumn, middleRow, maxError, indices);
+		}
+		else {
+			indices.push_back(getLocationOffset(aRow, aColumn));
+			indices.push_back(getLocationOffset(bRow, bColumn));
+			indices.push_back(getLocationOffset(cRow, cColumn));
+		}
+	}
+
+	//Convert row columns to offset
+	unsigned int getLocationOffset(unsigned int row, unsigned int column) {
+		return row * this->terrainDimension + column;
+	}
+
+public:
+
+	//Constructor
+	RtinMesher(unsigned int dimension, const std::vector<float>& heightMap) : heightMap(heightMap) {
+
+		//The dimension should be a power of 2 plus 1
+		if (dimension < 3 || ((dimension - 1) & (dimension - 2)) != 0 || heightMap.size() != dimension * dimension) {
+			throw std::invalid_argument("Terrain dimension must be a power of 2 plus 1.");
+		}
+
+		this->terrainDimension = dimension;
+		this->vertexErrors = std::vector<float>(dimension * dimension, 0.0);
+		computeVertexErrors();
+	}
+
+	//Add the indices of the triangles in the adaptive mesh to the index vector. The indices are heightmap offsets.
+	//The time taken is proportional to the number of triangles in the mesh.
+	void getIndices(float maxError, std::vector<int>& indices) {
+
+		int tileSize = this->terrainDimension - 1;
+		addTriangle(0, 0, tileSize, tileSize, tileSize, 0, maxError, indices);
+		addTriangle(tileSize, tileSize, 0, 0, 0, tileSize, maxError, indices);
+	}
+
+	//Get the error that will be seen if the vertex at this row and column is left out of the mesh
+	float getVertexError(unsigned int row, unsigned int column) {
+		return this->vertexErrors.at(getLocationOffset(row, column));
+	}
+
+};
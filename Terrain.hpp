@@ -1,18 +1,60 @@
+#pragma once
+
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
+#include "HeightPyramid.hpp"
+#include "TerrainBrush.hpp"
+#include "TiledHeightMap.hpp"
+
+//Rectangle of heightmap rows and columns whose heights have changed
+struct DirtyRegion {
+	unsigned int firstRow, firstColumn, lastRow, lastColumn;
+};
 
 class Terrain {
 
 private:
 
+	//Changes are merged into at most this many rectangles
+	const unsigned int MAX_DIRTY_REGIONS = 16;
+
 	int terrainDimension;
 
+	//Seed of the random numbers the terrain is made from. Engines are seeded with a seed sequence of the seed and a stream
+	//number, so that seed 0 differs from seed 1, neighbouring seeds do not start alike, and the streams of a terrain are independent.
+	unsigned int seed;
+
+	//Minimum and maximum heights of blocks of the heightmap
+	HeightPyramid heightPyramid;
+
+	//Areas changed since the mesh last caught up with the heights
+	std::vector<DirtyRegion> dirtyRegions;
+
+	//Are changes being recorded. They are not while the heights are being made, since all of them change.
+	bool dirtyTracked = true;
+
+	//Get the number of heights a region would cover if it was grown to take in another region
+	static unsigned int getMergedArea(const DirtyRegion& region, const DirtyRegion& otherRegion) {
+		return (std::max(region.lastRow, otherRegion.lastRow) - std::min(region.firstRow, otherRegion.firstRow) + 1) *
+			(std::max(region.lastColumn, otherRegion.lastColumn) - std::min(region.firstColumn, otherRegion.firstColumn) + 1);
+	}
+
+	//Grow a region to take in another region
+	static void mergeRegion(DirtyRegion& region, const DirtyRegion& otherRegion) {
+		region.firstRow = std::min(region.firstRow, otherRegion.firstRow);
+		region.firstColumn = std::min(region.firstColumn, otherRegion.firstColumn);
+		region.lastRow = std::max(region.lastRow, otherRegion.lastRow);
+		region.lastColumn = std::max(region.lastColumn, otherRegion.lastColumn);
+	}
+
 	//Are the coordinates passed in within the heightmap
 	bool isValidCoordinate(unsigned int row, unsigned int column) {
 
@@ -25,36 +67,34 @@ private:
 	}
 
 public:
-	//Constructor
-	Terrain(unsigned int dimension) {
+	//Constructor. Terrains made with the same dimension and seed have the same heights.
+	Terrain(unsigned int dimension, unsigned int seed = std::default_random_engine::default_seed) {
 
 		//The dimension should be a power of 2 plus 1
 		double logValue = log2(dimension - 1);
 		long logValueLong = logValue;
 		if (logValueLong == logValue) {
-			this->heightMap = std::shared_ptr<std::vector<float>>(new std::vector<float>(dimension * dimension, 0.0));
+			this->heightMap = TiledHeightMap(dimension);
 			this->terrainDimension = dimension;
+			this->seed = seed;
 		}
 		else {
 			throw std::invalid_argument("Terrain dimension must be a power of 2 plus 1.");
 		}
 	}
 
-	//Destructor
-	~Terrain() {
-		this->heightMap.reset();
-	}
-
 	//Return the terrain that was created
 	std::vector<float> getTerrain() {
-		return *this->heightMap;
+		std::vector<float> heights;
+		this->heightMap.toVector(heights);
+		return heights;
 	}
 
 	//Get the terrain height at a specific row and column position
 	float getHeightAt(unsigned int row, unsigned int column) {
 
 		if (isValidCoordinate(row, column)) {
-			return this->heightMap->at(row * this->terrainDimension + column);
+			return this->heightMap.get(row, column);
 		}
 		else {
 			std::stringstream errorMessage;
@@ -68,7 +108,13 @@ public:
 
 		if (isValidCoordinate(row, column)) {
 
-			this->heightMap->at(row * this->terrainDimension + column) = height;
+			this->heightMap.set(row, column, height);
+
+			//Keep the height pyramid in step once it has been built
+			if (this->heightPyramid.isBuilt()) {
+				this->heightPyramid.update(this->heightMap, row, column, row, column);
+			}
+			markDirty(row, column, row, column);
 		}
 		else {
 			std::stringstream errorMessage;
@@ -82,21 +128,208 @@ public:
 		return this->terrainDimension;
 	}
 
-protected:
+	//Get the seed of the random numbers the terrain is made from
+	unsigned int getSeed() {
+		return this->seed;
+	}
 
-	std::shared_ptr<std::vector<GLfloat>> heightMap;
+	//Get the name of the generator that made the terrain, as TerrainFactory knows it
+	virtual std::string getGeneratorName() {
+		return "";
+	}
 
-	//This method needs to be implemented by the child class
+	//Get the constants of the generator that made the terrain as name=value pairs separated by spaces
+	virtual std::string getGeneratorParameters() {
+		return "";
+	}
+
+	//Make the heights. This method needs to be implemented by the child class.
 	virtual void makeTerrain() = 0;
 
-	//Convert row columns to offset
-	unsigned int getLocationOffset(unsigned int row, unsigned int column) {
-		return row * this->terrainDimension + column;
+	//Make the heights without recording each change, and then mark the whole terrain dirty once
+	void generateTerrain() {
+
+		this->dirtyTracked = false;
+		makeTerrain();
+		this->dirtyTracked = true;
+		this->dirtyRegions.clear();
+		markDirty(0, 0, this->terrainDimension - 1, this->terrainDimension - 1);
+	}
+
+	//Can the heights be made a band of rows at a time with makeRows, which is the case when each row depends only on the
+	//constants of the generator and not on the rest of the heightmap
+	virtual bool canMakeRows() {
+		return false;
+	}
+
+	//Make the heights of a band of rows into an array, one row after the other, without the heightmap. The heights are the
+	//same as makeTerrain makes. Bands can be made on several threads at once.
+	virtual void makeRows(unsigned int /*firstRow*/, unsigned int /*rowCount*/, float* /*heights*/) {
+		throw std::logic_error("This terrain cannot be made a band of rows at a time.");
+	}
+
+	//Get the heights without copying them
+	const TiledHeightMap& getHeightMap() {
+		return this->heightMap;
+	}
+
+	//Take a snapshot of the heights, for example for undo. Only the tile pointers are copied. A tile is copied later only if
+	//the terrain changes it, so the snapshot costs the memory of the tiles that come to differ.
+	TiledHeightMap getSnapshot() {
+		return this->heightMap;
+	}
+
+	//Go back to a snapshot of this terrain. Only the tiles that differ from the snapshot are marked dirty and updated in the pyramid.
+	void restoreSnapshot(const TiledHeightMap& snapshot) {
+
+		if (snapshot.getDimension() != (unsigned int)this->terrainDimension) {
+			throw std::invalid_argument("Snapshot is of a different terrain.");
+		}
+
+		TiledHeightMap currentHeights = this->heightMap;
+		this->heightMap = snapshot;
+		const unsigned int TILE_DIMENSION = TiledHeightMap::TILE_DIMENSION;
+		unsigned int lastVertex = this->terrainDimension - 1;
+		for (unsigned int tileRow = 0; tileRow < snapshot.getTilesPerSide(); ++tileRow) {
+			for (unsigned int tileColumn = 0; tileColumn < snapshot.getTilesPerSide(); ++tileColumn) {
+				if (!snapshot.isSharedTile(currentHeights, tileRow, tileColumn)) {
+					unsigned int firstRow = tileRow * TILE_DIMENSION, firstColumn = tileColumn * TILE_DIMENSION;
+					unsigned int lastRow = std::min(firstRow + TILE_DIMENSION - 1, lastVertex), lastColumn = std::min(firstColumn + TILE_DIMENSION - 1, lastVertex);
+					if (this->heightPyramid.isBuilt()) {
+						this->heightPyramid.update(this->heightMap, firstRow, firstColumn, lastRow, lastColumn);
+					}
+					markDirty(firstRow, firstColumn, lastRow, lastColumn);
+				}
+			}
+		}
+	}
+
+	//Record that the heights in a rectangle have changed. A change next to or inside a recorded region grows that region, so
+	//that the strokes of an edit stay together. When there are too many regions the one that grows the least takes in the change.
+	void markDirty(unsigned int firstRow, unsigned int firstColumn, unsigned int lastRow, unsigned int lastColumn) {
+
+		if (!this->dirtyTracked) {
+			return;
+		}
+
+		DirtyRegion newRegion = { firstRow, firstColumn, lastRow, lastColumn };
+		for (unsigned int regionCounter = 0; regionCounter < this->dirtyRegions.size(); ++regionCounter) {
+			DirtyRegion& region = this->dirtyRegions[regionCounter];
+			if (region.firstRow <= lastRow + 1 && firstRow <= region.lastRow + 1 && region.firstColumn <= lastColumn + 1 && firstColumn <= region.lastColumn + 1) {
+				mergeRegion(region, newRegion);
+				return;
+			}
+		}
+
+		if (this->dirtyRegions.size() < MAX_DIRTY_REGIONS) {
+			this->dirtyRegions.push_back(newRegion);
+			return;
+		}
+
+		unsigned int bestRegion = 0, bestGrowth = std::numeric_limits<unsigned int>::max();
+		for (unsigned int regionCounter = 0; regionCounter < this->dirtyRegions.size(); ++regionCounter) {
+			const DirtyRegion& region = this->dirtyRegions[regionCounter];
+			unsigned int growth = getMergedArea(region, newRegion) - (region.lastRow - region.firstRow + 1) * (region.lastColumn - region.firstColumn + 1);
+			if (growth < bestGrowth) {
+				bestGrowth = growth;
+				bestRegion = regionCounter;
+			}
+		}
+		mergeRegion(this->dirtyRegions[bestRegion], newRegion);
+	}
+
+	//Apply one stroke of a brush centered at a row and column, which need not be whole numbers. The height pyramid and the dirty
+	//regions are kept up to date, and the tiles that changed are returned so that caches of the terrain can drop just those.
+	//Returns false if the brush is off the terrain, so that no heights changed.
+	bool applyBrush(TerrainBrush& brush, float centerRow, float centerColumn, std::vector<TerrainTile>& changedTiles) {
+
+		unsigned int firstRow, firstColumn, lastRow, lastColumn;
+		if (!brush.apply(this->heightMap, centerRow, centerColumn, changedTiles, firstRow, firstColumn, lastRow, lastColumn)) {
+			return false;
+		}
+
+		if (this->heightPyramid.isBuilt()) {
+			this->heightPyramid.update(this->heightMap, firstRow, firstColumn, lastRow, lastColumn);
+		}
+		markDirty(firstRow, firstColumn, lastRow, lastColumn);
+		return true;
+	}
+
+	//Hand over the regions changed since the last call and start recording again
+	void takeDirtyRegions(std::vector<DirtyRegion>& regions) {
+		regions.clear();
+		regions.swap(this->dirtyRegions);
+	}
+
+	//Forget the changes, for example after the whole terrain has been meshed
+	void clearDirtyRegions() {
+		this->dirtyRegions.clear();
+	}
+
+	//Get the minimum and maximum heights of blocks of the terrain. The pyramid is built in one pass the first time it is needed,
+	//so it should be asked for after makeTerrain. After that it is updated as heights are set.
+	HeightPyramid& getHeightPyramid() {
+
+		if (!this->heightPyramid.isBuilt()) {
+			this->heightPyramid.build(this->heightMap);
+		}
+		return this->heightPyramid;
+	}
+
+	//Get the lowest height of the terrain
+	float getMinHeight() {
+		return getHeightPyramid().getMinHeight();
+	}
+
+	//Get the highest height of the terrain
+	float getMaxHeight() {
+		return getHeightPyramid().getMaxHeight();
+	}
+
+	//Scale the terrain heights so that they go from the lowest to the highest height given
+	void normalizeHeights(float lowestHeight, float highestHeight) {
+
+		float minHeight = getMinHeight(), maxHeight = getMaxHeight();
+		float scale = maxHeight > minHeight ? (highestHeight - lowestHeight) / (maxHeight - minHeight) : 0.0;
+		float offset = lowestHeight - minHeight * scale;
+
+		const unsigned int TILE_SIZE = TiledHeightMap::TILE_DIMENSION * TiledHeightMap::TILE_DIMENSION;
+		for (unsigned int tileRow = 0; tileRow < this->heightMap.getTilesPerSide(); ++tileRow) {
+			for (unsigned int tileColumn = 0; tileColumn < this->heightMap.getTilesPerSide(); ++tileColumn) {
+
+				//Tiles that have not been allocated stay that way if zero stays zero
+				if (offset == 0.0 && !this->heightMap.isAllocatedTile(tileRow, tileColumn)) {
+					continue;
+				}
+				float* heights = this->heightMap.getWritableTile(tileRow, tileColumn);
+				for (unsigned int offsetCounter = 0; offsetCounter < TILE_SIZE; ++offsetCounter) {
+					heights[offsetCounter] = heights[offsetCounter] * scale + offset;
+				}
+			}
+		}
+		this->heightPyramid.rescale(scale, offset);
+		markDirty(0, 0, this->terrainDimension - 1, this->terrainDimension - 1);
+	}
+
+	//Find the distance along a ray to the terrain. Columns, heights and rows are used as the x, y and z coordinates.
+	//Returns false if the ray does not hit the terrain.
+	bool getRayIntersection(const float origin[3], const float direction[3], float& distance) {
+		return getHeightPyramid().intersectRay(this->heightMap, origin, direction, distance);
+	}
+
+protected:
+
+	//Heights stored in tiles that are shared with snapshots until they are changed
+	TiledHeightMap heightMap;
+
+	//Convert row columns to offset. Offsets are 64 bit because maps of 65537 x 65537 and more have over 2^32 heights.
+	unsigned long long getLocationOffset(unsigned int row, unsigned int column) {
+		return (unsigned long long)row * this->terrainDimension + column;
 	}
 
 	//Check if the offset passed in is within the heightmap
-	bool isValidOffset(unsigned int offset) {
-		if (offset < this->terrainDimension * this->terrainDimension) {
+	bool isValidOffset(unsigned long long offset) {
+		if (offset < (unsigned long long)this->terrainDimension * this->terrainDimension) {
 			return true;
 		}
 		else {
@@ -105,19 +338,19 @@ protected:
 	}
 
 	//Get the terrain height at a specific row and column position
-	float getHeightAt(unsigned int offset) {
+	float getHeightAt(unsigned long long offset) {
 
-		unsigned int row = offset / this->terrainDimension;
-		unsigned int column = offset % this->terrainDimension;
+		unsigned int row = (unsigned int)(offset / this->terrainDimension);
+		unsigned int column = (unsigned int)(offset % this->terrainDimension);
 		return getHeightAt(row, column);
 
 	}
 
 	//Set the terrain height at a specific offset
-	void setHeightAt(unsigned int offset, float height) {
+	void setHeightAt(unsigned long long offset, float height) {
 
-		unsigned int row = offset / this->terrainDimension;
-		unsigned int column = offset % this->terrainDimension;
+		unsigned int row = (unsigned int)(offset / this->terrainDimension);
+		unsigned int column = (unsigned int)(offset % this->terrainDimension);
 		setHeightAt(row, column, height);
 
 	}
@@ -143,54 +376,71 @@ protected:
 	char startLocation;
 
 	//Find first location in current row
-	unsigned int firstLocationInCurrentRow(unsigned int currentOffset) {
+	unsigned long long firstLocationInCurrentRow(unsigned long long currentOffset) {
 
-		unsigned int currentRow = currentOffset / getTerrainDimension();
+		unsigned long long currentRow = currentOffset / getTerrainDimension();
 		return currentRow * Terrain::getTerrainDimension();
 
 	}
 
 	//Find last location in current row
-	unsigned int lastLocationInCurrentRow(unsigned int currentOffset) {
+	unsigned long long lastLocationInCurrentRow(unsigned long long currentOffset) {
 
-		unsigned int currentRow = currentOffset / Terrain::getTerrainDimension();
+		unsigned long long currentRow = currentOffset / Terrain::getTerrainDimension();
 		return currentRow * Terrain::getTerrainDimension() + getTerrainDimension() - 1;
 
 	}
 	//Find the point on the terrain where deposition should start
-	unsigned int seedParticleDeposition() {
+	unsigned long long seedParticleDeposition() {
 
+		unsigned long long heightCount = (unsigned long long)getTerrainDimension() * getTerrainDimension();
 		if (this->startLocation == 'r' || this->startLocation == 'R') {
-			std::default_random_engine randomNumberGenerator;
-			std::uniform_int_distribution<int> distribution(0, getTerrainDimension() * getTerrainDimension() - 1);
+
+			//The start comes from a different stream of random numbers than the steps, so that it does not follow the first step
+			std::seed_seq startSeeds{ getSeed(), 1u };
+			std::default_random_engine randomNumberGenerator(startSeeds);
+			std::uniform_int_distribution<unsigned long long> distribution(0, heightCount - 1);
 			return distribution(randomNumberGenerator);
 		}
 		else {
-			return (getTerrainDimension() * getTerrainDimension()) / 2;
+			return heightCount / 2;
 		}
 
 	}
 
 	//Deposit a particle at a specified location and increase the terrain height there
-	void depositParticle(unsigned int offset) {
+	void depositParticle(unsigned long long offset) {
 		setHeightAt(offset, getHeightAt(offset) + PARTICLE_SIZE);
 	}
 
 public:
 
 	//Constructor
-	ParticleDepositionTerrain(unsigned int dimension, char startLocation) : Terrain (dimension) {
+	ParticleDepositionTerrain(unsigned int dimension, char startLocation, unsigned int seed = std::default_random_engine::default_seed) :
+		Terrain (dimension, seed) {
 		this->startLocation = startLocation;
 	}
 
+	std::string getGeneratorName() {
+		return "deposition";
+	}
+
+	std::string getGeneratorParameters() {
+		std::stringstream parameters;
+		parameters << "iterations=" << NUMBER_OF_ITERATIONS << " particleSize=" << PARTICLE_SIZE << " start=" <<
+			(this->startLocation == 'r' || this->startLocation == 'R' ? "random" : "center");
+		return parameters.str();
+	}
+
 	//Make the terrain based on particle deposition 
 	void makeTerrain() {
 
 		//Find the location to start depositing particles
-		unsigned int startingLocation = seedParticleDeposition(), currentLocation = startingLocation, nextLocation;
+		unsigned long long startingLocation = seedParticleDeposition(), currentLocation = startingLocation, nextLocation;
 
 		//Random number generator with four equally likely outcomes
-		std::default_random_engine randomNumberGenerator;
+		std::seed_seq stepSeeds{ getSeed(), 0u };
+		std::default_random_engine randomNumberGenerator(stepSeeds);
 		std::discrete_distribution<int> distribution{ 0.25, 0.25, 0.25, 0.25 };
 
 		//Deposit particles based on the number of iterations specified
@@ -224,12 +474,12 @@ public:
 				//Neighbor above
 			case 2:
 				{
-					  long neighborAbove = currentLocation - getTerrainDimension();
+					  long long neighborAbove = currentLocation - getTerrainDimension();
 					  if (neighborAbove >= 0 && isValidOffset(neighborAbove)) {
-						  nextLocation = (unsigned int)neighborAbove;
+						  nextLocation = (unsigned long long)neighborAbove;
 					  }
 					  else {//wrap to the corresponding element in last row
-						  nextLocation = getLocationOffset(getTerrainDimension() - 1, currentLocation);
+						  nextLocation = getLocationOffset(getTerrainDimension() - 1, (unsigned int)(currentLocation % getTerrainDimension()));
 					  }
 				}
 				break;
@@ -237,12 +487,12 @@ public:
 				//Neighbor below
 			case 3:
 				{
-					  unsigned int neighborBelow = currentLocation + getTerrainDimension();
+					  unsigned long long neighborBelow = currentLocation + getTerrainDimension();
 					  if (isValidOffset(neighborBelow)) {
 						  nextLocation = neighborBelow;
 					  }
 					  else {//wrap to the corresponding element in first row
-						  unsigned int columnOfLastRow = currentLocation % getTerrainDimension();
+						  unsigned int columnOfLastRow = (unsigned int)(currentLocation % getTerrainDimension());
 						  nextLocation = getLocationOffset(0, columnOfLastRow);
 					  }
 				}
@@ -273,10 +523,10 @@ private:
 	const float PARTICLE_SIZE = 0.01;
 
 	//If right, left, upper or lower neighbor is lower then the particle will roll down to that location
-	unsigned int getRollDownLocation(unsigned int currentLocation) {
+	unsigned long long getRollDownLocation(unsigned long long currentLocation) {
 
 		//Check neighbor on the right
-		unsigned int neighbor;
+		unsigned long long neighbor;
 		if (isValidOffset(currentLocation + 1)) {
 			neighbor = currentLocation + 1;
 		}
@@ -301,12 +551,12 @@ private:
 		}
 
 		//Check neighbor above
-		long neighborAbove = currentLocation - getTerrainDimension();
+		long long neighborAbove = currentLocation - getTerrainDimension();
 		if (neighborAbove >= 0 && isValidOffset(neighborAbove)) {
-			neighbor = (unsigned int)neighborAbove;
+			neighbor = (unsigned long long)neighborAbove;
 		}
 		else {//wrap to the corresponding element in last row
-			neighbor = getLocationOffset(getTerrainDimension() - 1, currentLocation);
+			neighbor = getLocationOffset(getTerrainDimension() - 1, (unsigned int)(currentLocation % getTerrainDimension()));
 		}
 		//Roll down if lower
 		if (getHeightAt(neighbor) < getHeightAt(currentLocation)) {
@@ -314,12 +564,12 @@ private:
 		}
 
 		//Check neighbor below
-		unsigned int neighborBelow = currentLocation + getTerrainDimension();
+		unsigned long long neighborBelow = currentLocation + getTerrainDimension();
 		if (isValidOffset(neighborBelow)) {
 			neighbor = neighborBelow;
 		}
 		else {//wrap to the corresponding element in first row
-			unsigned int columnOfLastRow = currentLocation % getTerrainDimension();
+			unsigned int columnOfLastRow = (unsigned int)(currentLocation % getTerrainDimension());
 			neighbor = getLocationOffset(0, columnOfLastRow);
 		}
 		//Roll down if lower
@@ -332,17 +582,30 @@ private:
 
 public:
 	//Constructor
-	RollDownParticleDepositionTerrain(unsigned int dimension, char startLocation) : ParticleDepositionTerrain(dimension, startLocation) {
+	RollDownParticleDepositionTerrain(unsigned int dimension, char startLocation, unsigned int seed = std::default_random_engine::default_seed) :
+		ParticleDepositionTerrain(dimension, startLocation, seed) {
+	}
+
+	std::string getGeneratorName() {
+		return "rolldown";
+	}
+
+	std::string getGeneratorParameters() {
+		std::stringstream parameters;
+		parameters << "iterations=" << NUMBER_OF_ITERATIONS << " particleSize=" << PARTICLE_SIZE << " start=" <<
+			(this->startLocation == 'r' || this->startLocation == 'R' ? "random" : "center");
+		return parameters.str();
 	}
 
 	//Make the terrain based on particle deposition 
 	void makeTerrain() {
 
 		//Find the location to start depositing particles
-		unsigned int startingLocation = seedParticleDeposition(), currentLocation = startingLocation, nextLocation, rollDownLocation;
+		unsigned long long startingLocation = seedParticleDeposition(), currentLocation = startingLocation, nextLocation, rollDownLocation;
 
 		//Random number generator with four equally likely outcomes
-		std::default_random_engine randomNumberGenerator;
+		std::seed_seq stepSeeds{ getSeed(), 0u };
+		std::default_random_engine randomNumberGenerator(stepSeeds);
 		std::discrete_distribution<int> distribution{ 0.25, 0.25, 0.25, 0.25 };
 
 		//Deposit particles based on the number of iterations specified
@@ -376,12 +639,12 @@ public:
 				//Neighbor above
 			case 2:
 			{
-					  long neighborAbove = currentLocation - getTerrainDimension();
+					  long long neighborAbove = currentLocation - getTerrainDimension();
 					  if (neighborAbove >= 0 && isValidOffset(neighborAbove)) {
-						  nextLocation = (unsigned int)neighborAbove;
+						  nextLocation = (unsigned long long)neighborAbove;
 					  }
 					  else {//wrap to the corresponding element in last row
-						  nextLocation = getLocationOffset(getTerrainDimension() - 1, currentLocation);
+						  nextLocation = getLocationOffset(getTerrainDimension() - 1, (unsigned int)(currentLocation % getTerrainDimension()));
 					  }
 			}
 				break;
@@ -389,12 +652,12 @@ public:
 				//Neighbor below
 			case 3:
 			{
-					  unsigned int neighborBelow = currentLocation + getTerrainDimension();
+					  unsigned long long neighborBelow = currentLocation + getTerrainDimension();
 					  if (isValidOffset(neighborBelow)) {
 						  nextLocation = neighborBelow;
 					  }
 					  else {//wrap to the corresponding element in first row
-						  unsigned int columnOfLastRow = currentLocation % getTerrainDimension();
+						  unsigned int columnOfLastRow = (unsigned int)(currentLocation % getTerrainDimension());
 						  nextLocation = getLocationOffset(0, columnOfLastRow);
 					  }
 			}
@@ -417,7 +680,7 @@ class FaultTerrain : public Terrain {
 private:
 
 	//Vector containing pairs of offsets for the two ends of fault lines
-	std::vector<unsigned int> faultLineEnds;
+	std::vector<unsigned long long> faultLineEnds;
 
 	//Number of iterations
 	const unsigned int NUMBER_OF_ITERATIONS = 300;
@@ -425,15 +688,17 @@ private:
 	void generateFaults() {
 
 		//Random number generator for selecting the left or top edge at random
-		std::default_random_engine randomTerrainEdgeSelector;
+		std::seed_seq edgeSeeds{ getSeed(), 0u };
+		std::default_random_engine randomTerrainEdgeSelector(edgeSeeds);
 		std::discrete_distribution<int> equallyLikelyDistribution{ 0.5, 0.5 };
 
 		//Random number generator for selecting one cell from an edge
-		std::default_random_engine randomEdgeCellGenerator;
+		std::seed_seq cellSeeds{ getSeed(), 1u };
+		std::default_random_engine randomEdgeCellGenerator(cellSeeds);
 		std::uniform_int_distribution<int> edgeCellDistribution(0, getTerrainDimension() - 1);
 
 		//Generate faults in the terrain
-		unsigned int randomEdge = 0, randomEdgeCell1 = 0, randomEdgeCell2 = 0, faultLineEnd1 = 0, faultLineEnd2 = 0;
+		unsigned long long dimension = getTerrainDimension(), randomEdge = 0, randomEdgeCell1 = 0, randomEdgeCell2 = 0, faultLineEnd1 = 0, faultLineEnd2 = 0;
 		for (auto counter = 0; counter < NUMBER_OF_ITERATIONS; ++counter) {
 
 			//Select the left or top edge at random
@@ -447,14 +712,14 @@ private:
 
 				//Left edge to right edge
 			case 0:
-				faultLineEnd1 = getTerrainDimension() * randomEdgeCell1;
-				faultLineEnd2 = getTerrainDimension() * (randomEdgeCell2 + 1) - 1;
+				faultLineEnd1 = dimension * randomEdgeCell1;
+				faultLineEnd2 = dimension * (randomEdgeCell2 + 1) - 1;
 				break;
 
 				//Top edge to bottom edge
 			case 1:
 				faultLineEnd1 = randomEdgeCell1;
-				faultLineEnd2 = getTerrainDimension() * (getTerrainDimension() - 1) + randomEdgeCell2;
+				faultLineEnd2 = dimension * (dimension - 1) + randomEdgeCell2;
 				break;
 
 			}
@@ -464,46 +729,60 @@ private:
 		}
 	}
 
+	//Divide rounding down, for a positive divisor
+	static long long divideRoundingDown(long long dividend, long long divisor) {
+		return dividend >= 0 ? dividend / divisor : -((-dividend + divisor - 1) / divisor);
+	}
+
 public:
 	//Constructor
-	FaultTerrain(int dimension) : Terrain(dimension) {
+	FaultTerrain(int dimension, unsigned int seed = std::default_random_engine::default_seed) : Terrain(dimension, seed) {
 		generateFaults();
 	}
 
+	std::string getGeneratorParameters() {
+		std::stringstream parameters;
+		parameters << "faults=" << NUMBER_OF_ITERATIONS;
+		return parameters.str();
+	}
+
 protected:
 
 	unsigned int getFaultCount() {
 		return this->faultLineEnds.size() / 2;
 	}
 
-	unsigned int getFaultLineEnd(unsigned int offset) {
+	unsigned long long getFaultLineEnd(unsigned int offset) {
 		return this->faultLineEnds.at(offset);
 	}
 
-	//Should the passed in point be raised or not
-	bool raisePoint(unsigned int faultLineEnd1, unsigned int faultLineEnd2, unsigned int point) {
-
-		unsigned int faultLineEnd1Row = 0, faultLineEnd1Column = 0, faultLineEnd2Row = 0, faultLineEnd2Column = 0, pointRow, pointColumn = 0;
-
-		faultLineEnd1Row = faultLineEnd1 / getTerrainDimension();
-		faultLineEnd1Column = faultLineEnd1 % getTerrainDimension();
+	//Find the points of a row that a fault raises. A point is raised when it is on the left of the fault going from its first
+	//end to its second. The fault is a straight line, so the points raised are a run at one end of the row, from the first
+	//column up to but not including the end column. Returns an empty run if none are raised.
+	void getRaisedColumns(unsigned int fault, unsigned int row, unsigned int& firstColumn, unsigned int& endColumn) {
 
-		faultLineEnd2Row = faultLineEnd2 / getTerrainDimension();
-		faultLineEnd2Column = faultLineEnd2 % getTerrainDimension();
+		long long dimension = getTerrainDimension();
+		long long faultLineEnd1Row = this->faultLineEnds[2 * fault] / dimension, faultLineEnd1Column = this->faultLineEnds[2 * fault] % dimension;
+		long long faultLineEnd2Row = this->faultLineEnds[2 * fault + 1] / dimension, faultLineEnd2Column = this->faultLineEnds[2 * fault + 1] % dimension;
 
-		pointRow = point / getTerrainDimension();
-		pointColumn = point % getTerrainDimension();
+		//A point is raised when columnSpan * (row - end 1 row) - rowSpan * (column - end 1 column) > 0, that is when
+		//rowSpan * column < limit
+		long long rowSpan = faultLineEnd2Row - faultLineEnd1Row, columnSpan = faultLineEnd2Column - faultLineEnd1Column;
+		long long limit = columnSpan * (row - faultLineEnd1Row) + rowSpan * faultLineEnd1Column;
 
-		int pointLocation = (faultLineEnd2Column - faultLineEnd1Column) * (pointRow - faultLineEnd1Row) -
-			(faultLineEnd2Row - faultLineEnd1Row) * (pointColumn - faultLineEnd1Column);
-
-		if (pointLocation > 0) {
-			return true;
+		long long first = 0, end = 0;
+		if (rowSpan == 0) {
+			end = limit > 0 ? dimension : 0;
+		}
+		else if (rowSpan > 0) {
+			end = -divideRoundingDown(-limit, rowSpan);
 		}
 		else {
-			return false;
+			first = divideRoundingDown(-limit, -rowSpan) + 1;
+			end = dimension;
 		}
-		
+		firstColumn = (unsigned int)std::min(std::max(first, 0LL), dimension);
+		endColumn = (unsigned int)std::max(std::min(end, dimension), (long long)firstColumn);
 	}
 
 	//This method needs to be implemented by the child class
@@ -518,26 +797,70 @@ private:
 	//This is the size of each particle deposited on the terrain
 	const float STEP_SIZE = 0.004;
 
+	//Heights of a point raised by no faults, one fault, two faults and so on. They are added up one step at a time, the way
+	//raising a point fault by fault does, so that they are exactly the same heights.
+	std::vector<float> raisedHeights;
+
 public:
 	//Constructor
-	StepFaultTerrain(int dimension) : FaultTerrain(dimension) {
+	StepFaultTerrain(int dimension, unsigned int seed = std::default_random_engine::default_seed) : FaultTerrain(dimension, seed) {
+
+		this->raisedHeights.push_back(0.0);
+		for (unsigned int faultCounter = 0; faultCounter < getFaultCount(); ++faultCounter) {
+			this->raisedHeights.push_back(this->raisedHeights.back() + STEP_SIZE);
+		}
 	}
 
-	void makeTerrain() {
+	std::string getGeneratorName() {
+		return "stepfault";
+	}
+
+	std::string getGeneratorParameters() {
+		std::stringstream parameters;
+		parameters << FaultTerrain::getGeneratorParameters() << " stepSize=" << STEP_SIZE;
+		return parameters.str();
+	}
 
-		unsigned int numberOfFaultLineEnds = 2 * getFaultCount(), totalNumberOfPoints = getTerrainDimension() * getTerrainDimension();
-		//Retrieve the fault line and create faults in terrain
-		for (auto faultCounter = 0; faultCounter < numberOfFaultLineEnds; faultCounter += 2) {
+	bool canMakeRows() {
+		return true;
+	}
 
-			//Loop through each point in terrain and raise it if needed
-			for (auto pointCounter = 0; pointCounter < totalNumberOfPoints; ++pointCounter) {
+	//Count the faults raising each point of a row. Each fault raises a run of the row, so the count goes up by one where the
+	//run starts and down by one where it ends.
+	void makeRows(unsigned int firstRow, unsigned int rowCount, float* heights) {
 
-				if (raisePoint(getFaultLineEnd(faultCounter), getFaultLineEnd(faultCounter + 1), pointCounter)) {
-					setHeightAt(pointCounter, getHeightAt(pointCounter) + STEP_SIZE);
+		unsigned int dimension = getTerrainDimension(), firstColumn, endColumn;
+		std::vector<int> raisedCountChanges(dimension + 1);
+		for (unsigned int row = firstRow; row < firstRow + rowCount; ++row) {
 
-				}
+			std::fill(raisedCountChanges.begin(), raisedCountChanges.end(), 0);
+			for (unsigned int faultCounter = 0; faultCounter < getFaultCount(); ++faultCounter) {
+				getRaisedColumns(faultCounter, row, firstColumn, endColumn);
+				++raisedCountChanges[firstColumn];
+				--raisedCountChanges[endColumn];
+			}
+
+			float* rowHeights = heights + (size_t)(row - firstRow) * dimension;
+			int raisedCount = 0;
+			for (unsigned int column = 0; column < dimension; ++column) {
+				raisedCount += raisedCountChanges[column];
+				rowHeights[column] = this->raisedHeights[raisedCount];
+			}
+		}
+	}
+
+	void makeTerrain() {
+
+		//Each row is made on its own and then stored
+		unsigned int dimension = getTerrainDimension();
+		std::vector<float> heights(dimension);
+		for (unsigned int row = 0; row < dimension; ++row) {
+			makeRows(row, 1, heights.data());
+			for (unsigned int column = 0; column < dimension; ++column) {
+				this->heightMap.set(row, column, heights[column]);
 			}
 		}
+		markDirty(0, 0, dimension - 1, dimension - 1);
 	}
 
 };
@@ -547,21 +870,31 @@ class BumpTerrain : public Terrain {
 
 private:
 
+	//Square of heights a bump may raise, with the heightmap row and column of its center. Bumps have always been raised with
+	//the row and column of the bump center swapped, and the square is turned the same way.
+	struct BumpArea {
+		unsigned int centerRow, centerColumn, firstRow, lastRow, firstColumn, lastColumn;
+	};
+
 	double bumpDiameter = 0;
 
 	const int NUMBER_OF_ITERATIONS = 1000;
 
 	//Vector containing bump centers
-	std::vector<unsigned int> bumpCenters;
+	std::vector<unsigned long long> bumpCenters;
+
+	//Areas of the bumps that are within the terrain, in the order the bumps are raised
+	std::vector<BumpArea> bumpAreas;
 
 	//Randomly generate bump locations throughout the terrain
 	void generateBumpCenters() {
 
 		//Random number generator for selecting a cell in the terrain
-		std::default_random_engine randomCellSelector;
-		std::uniform_int_distribution<int> randomCellDistribution(0, getTerrainDimension() * getTerrainDimension() - 1);
+		std::seed_seq cellSeeds{ getSeed(), 0u };
+		std::default_random_engine randomCellSelector(cellSeeds);
+		std::uniform_int_distribution<unsigned long long> randomCellDistribution(0, (unsigned long long)getTerrainDimension() * getTerrainDimension() - 1);
 
-		unsigned int bumpLocation;
+		unsigned long long bumpLocation;
 		for (auto bumpCounter = 0; bumpCounter < NUMBER_OF_ITERATIONS; ++bumpCounter) {
 
 			//Generate and store bump centers
@@ -579,86 +912,130 @@ private:
 
 	}
 
-	//Create a cosine bump at this location
-	void createBump(unsigned int bumpCenter) {
+	//Find the area of a bump. Returns false if the bump is not within the terrain, in which case it is not raised.
+	bool findBumpArea(unsigned long long bumpCenter, BumpArea& area) {
 
 		//Check if bump is within the terrain
-		long bumpTop = 0, bumpBottom = 0, bumpLeft = 0, bumpRight = 0;
-		bumpTop = bumpCenter - (getTerrainDimension() * bumpDiameter / 2) - 15 * getTerrainDimension();
-		bumpBottom = bumpCenter + (getTerrainDimension() * bumpDiameter / 2) + 15 * getTerrainDimension();
+		unsigned int dimension = getTerrainDimension();
+		long long bumpTop = 0, bumpBottom = 0, bumpLeft = 0, bumpRight = 0;
+		bumpTop = bumpCenter - (dimension * bumpDiameter / 2) - 15.0 * dimension;
+		bumpBottom = bumpCenter + (dimension * bumpDiameter / 2) + 15.0 * dimension;
 		bumpLeft = bumpCenter - bumpDiameter / 2 - 15;
 		bumpRight = bumpCenter + bumpDiameter / 2 + 15;
 
 		//Quit if bump top is outside the terrain
 		if (bumpTop < 0) {
-			return;
+			return false;
 		}
 
 		//Quit if bump bottom is outside the terrain
-		if (!isValidOffset((unsigned int)bumpBottom)) {
-			return;
+		if (!isValidOffset((unsigned long long)bumpBottom)) {
+			return false;
 		}
 
 		//Quit if bump left is outside the terrain or not on same row
-		unsigned int bumpCenterRow, bumpLeftRow, bumpRightRow, bumpTopRow = 0, bumpBottomRow = 0, bumpLeftColumn = 0, bumpRightColumn = 0, bumpCenterColumn = 0, cellLocation = 0;
 		if (bumpLeft < 0 || bumpRight < 0) {
-			return;
+			return false;
 		}
-		if (!isValidOffset((unsigned int)bumpLeft) || !isValidOffset((unsigned int)bumpRight)) {
-			return;
+		if (!isValidOffset((unsigned long long)bumpLeft) || !isValidOffset((unsigned long long)bumpRight)) {
+			return false;
 		}
 
-		bumpCenterRow = bumpCenter / getTerrainDimension();
-		bumpLeftRow = bumpLeft / getTerrainDimension();
-		bumpRightRow = bumpRight / getTerrainDimension();
-
+		unsigned int bumpCenterRow = bumpCenter / dimension, bumpLeftRow = bumpLeft / dimension, bumpRightRow = bumpRight / dimension;
 		if (bumpCenterRow != bumpLeftRow || bumpCenterRow != bumpRightRow) {
-			return;
+			return false;
 		}
 
-		//Loop through every cell in the square encircling the bump
-		bumpTopRow = bumpTop / getTerrainDimension();
-		bumpBottomRow = bumpBottom / getTerrainDimension();
-		bumpLeftColumn = bumpLeft % getTerrainDimension();
-		bumpRightColumn = bumpRight % getTerrainDimension();
-		bumpCenterColumn = bumpCenter % getTerrainDimension();
-		int verticalDistance = 0, horizontalDistance = 0;
+		//The square encircling the bump, with rows and columns swapped
+		area.centerRow = bumpCenter % dimension;
+		area.centerColumn = bumpCenterRow;
+		area.firstRow = bumpLeft % dimension;
+		area.lastRow = bumpRight % dimension;
+		area.firstColumn = bumpTop / dimension;
+		area.lastColumn = bumpBottom / dimension;
+		return true;
+	}
+
+	//Raise the heights of a row of a bump area by cosine amounts. The heights start at the first column given.
+	void raiseBumpRow(const BumpArea& area, unsigned int row, unsigned int firstColumn, float* heights) const {
+
+		int verticalDistance = 0, horizontalDistance = (int)row - (int)area.centerRow;
 		double distanceFromCenter = 0;
 		double cellLocationAngleEquivalent = 0;
 		float cellHeight = 0.0;
-		for (auto rowCounter = bumpTopRow; rowCounter <= bumpBottomRow; ++rowCounter) {
-			for (auto columnCounter = bumpLeftColumn; columnCounter <= bumpRightColumn; ++columnCounter) {
-				//Check if this cell is within the dump diamet er
-				verticalDistance = rowCounter - bumpCenterRow;
-				horizontalDistance = columnCounter - bumpCenterColumn;
-				distanceFromCenter = sqrt(pow(verticalDistance, 2) + pow(horizontalDistance, 2));
-				//If cell is within the bump diameter raise it by cosine amount
-				if (distanceFromCenter <= bumpDiameter) {
-					cellLocationAngleEquivalent = (distanceFromCenter / bumpDiameter) * M_PI / 2.0;
-					cellHeight = cos(cellLocationAngleEquivalent) / 35.0;
-					cellLocation = getLocationOffset(columnCounter, rowCounter);
-					setHeightAt(cellLocation, getHeightAt(cellLocation) + cellHeight);
-				}
+		for (unsigned int column = area.firstColumn; column <= area.lastColumn; ++column) {
+			//Check if this cell is within the bump diameter
+			verticalDistance = (int)column - (int)area.centerColumn;
+			distanceFromCenter = sqrt(pow(verticalDistance, 2) + pow(horizontalDistance, 2));
+			//If cell is within the bump diameter raise it by cosine amount
+			if (distanceFromCenter <= bumpDiameter) {
+				cellLocationAngleEquivalent = (distanceFromCenter / bumpDiameter) * M_PI / 2.0;
+				cellHeight = cos(cellLocationAngleEquivalent) / 35.0;
+				heights[column - firstColumn] += cellHeight;
 			}
-
 		}
 	}
 
 public:
 	//Constructor
-	BumpTerrain(int dimension) : Terrain(dimension) {
+	BumpTerrain(int dimension, unsigned int seed = std::default_random_engine::default_seed) : Terrain(dimension, seed) {
+
 		generateBumpCenters();
 		setBumpDiameter();
+
+		BumpArea area;
+		for (unsigned int bumpCounter = 0; bumpCounter < this->bumpCenters.size(); ++bumpCounter) {
+			if (findBumpArea(this->bumpCenters[bumpCounter], area)) {
+				this->bumpAreas.push_back(area);
+			}
+		}
 	}
 
-	void makeTerrain() {
+	std::string getGeneratorName() {
+		return "bump";
+	}
+
+	std::string getGeneratorParameters() {
+		std::stringstream parameters;
+		parameters << "bumps=" << NUMBER_OF_ITERATIONS << " bumpDiameter=" << bumpDiameter;
+		return parameters.str();
+	}
+
+	bool canMakeRows() {
+		return true;
+	}
+
+	//Raise the rows of the band that each bump covers, bump by bump
+	void makeRows(unsigned int firstRow, unsigned int rowCount, float* heights) {
+
+		unsigned int dimension = getTerrainDimension(), lastRow = firstRow + rowCount - 1;
+		std::fill(heights, heights + (size_t)rowCount * dimension, 0.0f);
+		for (unsigned int bumpCounter = 0; bumpCounter < this->bumpAreas.size(); ++bumpCounter) {
+			const BumpArea& area = this->bumpAreas[bumpCounter];
+			for (unsigned int row = std::max(area.firstRow, firstRow); row <= std::min(area.lastRow, lastRow); ++row) {
+				raiseBumpRow(area, row, 0, heights + (size_t)(row - firstRow) * dimension);
+			}
+		}
+	}
 
-		//Loop through the bump locations and create cosine bumps
-		unsigned int numberOfBumps = bumpCenters.size();
-		for (auto bumpCounter = 0; bumpCounter < numberOfBumps; ++bumpCounter) {
+	void makeTerrain() {
 
-			//Create a bump at this location
-			createBump(bumpCenters.at(bumpCounter));
+		//Loop through the bump areas and create cosine bumps
+		std::vector<float> heights;
+		for (unsigned int bumpCounter = 0; bumpCounter < this->bumpAreas.size(); ++bumpCounter) {
+
+			//Create a bump in this area a row at a time
+			const BumpArea& area = this->bumpAreas[bumpCounter];
+			unsigned int columnCount = area.lastColumn - area.firstColumn + 1;
+			heights.resize(columnCount);
+			for (unsigned int row = area.firstRow; row <= area.lastRow; ++row) {
+				this->heightMap.getRow(row, area.firstColumn, columnCount, heights.data());
+				raiseBumpRow(area, row, area.firstColumn, heights.data());
+				for (unsigned int column = area.firstColumn; column <= area.lastColumn; ++column) {
+					this->heightMap.set(row, column, heights[column - area.firstColumn]);
+				}
+			}
+			markDirty(area.firstRow, area.firstColumn, area.lastRow, area.lastColumn);
 
 		}
 
@@ -675,7 +1052,7 @@ private:
 
 	//Random number generator for selecting a cell in the terrain
 	std::default_random_engine roughnessGenerator;
-	std::normal_distribution<float> distribution = std::normal_distribution<GLfloat>(0.0, 0.7);
+	std::normal_distribution<float> distribution = std::normal_distribution<float>(0.0, 0.7);
 
 	//This method takes the top left and bottom right coordinates of a terrain and subdivides it using the square-diamond method. 
 	void subDivide(unsigned int topLeftRow, unsigned int topLeftColumn, unsigned int bottomRightRow, unsigned int bottomRightColumn, float roughness) {
@@ -749,7 +1126,19 @@ private:
 public:
 
 	//Constructor
-	SquareDiamondTerrain(int dimension) : Terrain(dimension) {
+	SquareDiamondTerrain(int dimension, unsigned int seed = std::default_random_engine::default_seed) : Terrain(dimension, seed) {
+		std::seed_seq roughnessSeeds{ seed, 0u };
+		this->roughnessGenerator.seed(roughnessSeeds);
+	}
+
+	std::string getGeneratorName() {
+		return "squarediamond";
+	}
+
+	std::string getGeneratorParameters() {
+		std::stringstream parameters;
+		parameters << "roughness=" << TERRAIN_ROUGHNESS << " deviation=" << distribution.stddev();
+		return parameters.str();
 	}
 
 	void makeTerrain() {
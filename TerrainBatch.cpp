@@ -0,0 +1,237 @@
+#define _CRT_SECURE_NO_DEPRECATE
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include "HeightMapCodec.hpp"
+#include "HeightMapFile.hpp"
+#include "MeshExporter.hpp"
+#include "TerrainCache.hpp"
+#include "TerrainFactory.hpp"
+#include "TerrainStreamer.hpp"
+#include "ThreadPool.hpp"
+#include "TilePyramidExporter.hpp"
+
+//Generates terrains without a display. Every job makes one terrain and writes its heights to a file, and the jobs are run on
+//a thread pool. Nothing here uses OpenGL, so it builds and links without it.
+
+//Keeps the lines written by the jobs from running into each other
+std::mutex outputMutex;
+
+//Number of jobs that could not make or write their terrain
+std::atomic<unsigned int> failedJobs(0);
+
+//Terrains made before, if a cache directory was given
+std::shared_ptr<TerrainCache> terrainCache;
+
+//Format the mesh is also written in, glb or ply, if one was given
+std::string meshFormat;
+
+//Largest error of the compressed heightmap written for archiving, zero for lossless, or negative if none is written
+float archiveMaxError = -1.0;
+
+//Are the map tiles of every zoom level also written
+bool exportTiles = false;
+
+//Number of threads each job streams its rows, codes its archive and writes its tiles on, or zero for one for every core.
+//Several jobs at once already keep every core busy, so each job then uses one.
+unsigned int jobThreadCount = 0;
+
+//Are the terrains made a band of rows at a time and written as they are made, instead of being held whole
+bool streamRows = false;
+
+//Show how the program is used
+void printUsage() {
+	std::cerr << "Usage: TerrainBatch [-j threads] [-n jobs] [-o directory] [-c directory] [-m format] [-z error] [-p] [-s] [-r] type dimension seed" << std::endl
+		<< "  type       deposition, rolldown, squarediamond, stepfault or bump" << std::endl
+		<< "  dimension  a power of 2 plus 1" << std::endl
+		<< "  seed       seed of the first job. Each further job uses the next seed." << std::endl
+		<< "  -j         number of jobs run at the same time, one for every core by default" << std::endl
+		<< "  -n         number of terrains to make, 1 by default" << std::endl
+		<< "  -o         directory the heightmaps are written to, the current directory by default" << std::endl
+		<< "  -c         directory of a cache of terrains, so that terrains made before are not made again" << std::endl
+		<< "  -m         also write the full resolution mesh as glb or ply" << std::endl
+		<< "  -z         also write the heightmap compressed for archiving, with heights off by at most this error, 0 for lossless" << std::endl
+		<< "  -p         also write a pyramid of map tiles to a directory next to the heightmap" << std::endl
+		<< "  -s         make stepfault and bump terrains a band of rows at a time and write them as they are made, for terrains" << std::endl
+		<< "             too large to hold. It cannot be used with -c, -z or -p." << std::endl
+		<< "  -r         start particle deposition at a random point instead of the center" << std::endl;
+}
+
+//Read a whole number argument. Returns false if it is not one.
+bool parseNumber(const char* argument, unsigned long& number) {
+
+	char* end;
+	number = std::strtoul(argument, &end, 10);
+	return *argument != '\0' && *end == '\0';
+}
+
+//Read a height error argument. Returns false if it is not a number of zero or more.
+bool parseError(const char* argument, float& error) {
+
+	char* end;
+	error = (float)std::strtod(argument, &end);
+	return *argument != '\0' && *end == '\0' && error >= 0.0;
+}
+
+//Make a terrain a band of rows at a time and write each band to the heightmap file, and the mesh if there is one, as it is
+//made. Returns what went wrong, or nothing if the files were written.
+std::string streamTerrain(Terrain& terrain, const std::string& fileName) {
+
+	if (!terrain.canMakeRows()) {
+		return terrain.getGeneratorName() + " terrains cannot be made a band of rows at a time";
+	}
+
+	//A GLB file needs the range of the heights before them, which takes a pass of its own
+	unsigned int dimension = terrain.getTerrainDimension();
+	float minHeight = 0.0, maxHeight = 0.0;
+	if (meshFormat == "glb") {
+		TerrainStreamer::findHeightRange(terrain, minHeight, maxHeight, jobThreadCount);
+	}
+
+	HeightMapFile::BandWriter heightMapWriter(fileName, dimension, HeightMapFile::getInfo(terrain));
+	std::vector<HeightBandSink*> sinks(1, &heightMapWriter);
+	std::string meshName = fileName.substr(0, fileName.size() - 3) + meshFormat;
+	std::shared_ptr<MeshExporter::BandWriter> meshWriter;
+	if (meshFormat == "glb") {
+		meshWriter = std::shared_ptr<MeshExporter::BandWriter>(new MeshExporter::BandWriter(meshName, dimension, minHeight, maxHeight));
+	}
+	else if (meshFormat == "ply") {
+		meshWriter = std::shared_ptr<MeshExporter::BandWriter>(new MeshExporter::BandWriter(meshName, dimension));
+	}
+	if (meshWriter) {
+		sinks.push_back(meshWriter.get());
+	}
+
+	if (!TerrainStreamer::stream(terrain, sinks, jobThreadCount)) {
+		return "cannot write " + fileName + (meshWriter ? " or " + meshName : "");
+	}
+	return "";
+}
+
+//Make one terrain and write it to disk
+void runJob(const std::string& typeName, unsigned int dimension, unsigned int seed, char startLocation, const std::string& outputDirectory) {
+
+	std::stringstream fileName;
+	fileName << outputDirectory << "/" << typeName << "_" << dimension << "_" << seed << ".thm";
+
+	std::chrono::steady_clock::time_point jobStart = std::chrono::steady_clock::now();
+	std::string error;
+	bool cached = false;
+	try {
+		if (streamRows) {
+			error = streamTerrain(*TerrainFactory::construct(typeName, dimension, seed, startLocation), fileName.str());
+		}
+		else {
+			std::shared_ptr<Terrain> terrain = terrainCache ? terrainCache->get(typeName, dimension, seed, startLocation, cached) :
+				TerrainFactory::create(typeName, dimension, seed, startLocation);
+			if (!HeightMapFile::save(fileName.str(), *terrain)) {
+				error = "cannot write " + fileName.str();
+			}
+
+			//The mesh goes next to the heightmap
+			std::string meshName = fileName.str().substr(0, fileName.str().size() - 3) + meshFormat;
+			if (error.empty() && meshFormat == "glb" && !MeshExporter::exportGlb(terrain->getHeightMap(), meshName)) {
+				error = "cannot write " + meshName;
+			}
+			else if (error.empty() && meshFormat == "ply" && !MeshExporter::exportPly(terrain->getHeightMap(), meshName)) {
+				error = "cannot write " + meshName;
+			}
+
+			std::string archiveName = fileName.str().substr(0, fileName.str().size() - 3) + "thc";
+			if (error.empty() && archiveMaxError >= 0.0 && !HeightMapCodec::save(archiveName, terrain->getHeightMap(), archiveMaxError, jobThreadCount)) {
+				error = "cannot write " + archiveName;
+			}
+
+			std::string tileDirectory = fileName.str().substr(0, fileName.str().size() - 4) + "_tiles";
+			if (error.empty() && exportTiles && !TilePyramidExporter::exportPyramid(terrain->getHeightMap(), tileDirectory, jobThreadCount)) {
+				error = "cannot write " + tileDirectory;
+			}
+		}
+	}
+	catch (const std::exception& exception) {
+		error = exception.what();
+	}
+	float jobTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - jobStart).count();
+
+	std::lock_guard<std::mutex> lock(outputMutex);
+	if (error.empty()) {
+		std::cout << "Wrote " << fileName.str() << " in " << jobTime << " ms" << (cached ? " from the cache" : "") << std::endl;
+	}
+	else {
+		++failedJobs;
+		std::cerr << "Seed " << seed << " failed: " << error << std::endl;
+	}
+}
+
+int main(int argc, char **argv) {
+
+	unsigned long threadCount = 0, jobCount = 1;
+	std::string outputDirectory = ".";
+	char startLocation = 'c';
+
+	//Options come before the type, dimension and seed
+	int argumentCounter = 1;
+	for (; argumentCounter < argc && argv[argumentCounter][0] == '-'; ++argumentCounter) {
+		std::string option = argv[argumentCounter];
+		bool hasValue = argumentCounter + 1 < argc;
+		if (option == "-j" && hasValue && parseNumber(argv[argumentCounter + 1], threadCount)) {
+			++argumentCounter;
+		}
+		else if (option == "-n" && hasValue && parseNumber(argv[argumentCounter + 1], jobCount)) {
+			++argumentCounter;
+		}
+		else if (option == "-o" && hasValue) {
+			outputDirectory = argv[++argumentCounter];
+		}
+		else if (option == "-c" && hasValue) {
+			terrainCache = std::shared_ptr<TerrainCache>(new TerrainCache(argv[++argumentCounter]));
+		}
+		else if (option == "-m" && hasValue && (std::string(argv[argumentCounter + 1]) == "glb" || std::string(argv[argumentCounter + 1]) == "ply")) {
+			meshFormat = argv[++argumentCounter];
+		}
+		else if (option == "-z" && hasValue && parseError(argv[argumentCounter + 1], archiveMaxError)) {
+			++argumentCounter;
+		}
+		else if (option == "-p") {
+			exportTiles = true;
+		}
+		else if (option == "-s") {
+			streamRows = true;
+		}
+		else if (option == "-r") {
+			startLocation = 'r';
+		}
+		else {
+			printUsage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	unsigned long dimension, firstSeed;
+	if (argc - argumentCounter != 3 || !TerrainFactory::isValidType(argv[argumentCounter]) ||
+		(streamRows && (terrainCache || archiveMaxError >= 0.0 || exportTiles)) || !parseNumber(argv[argumentCounter + 1], dimension) || !parseNumber(argv[argumentCounter + 2], firstSeed)) {
+		printUsage();
+		return EXIT_FAILURE;
+	}
+	std::string typeName = argv[argumentCounter];
+	if (jobCount > 1) {
+		jobThreadCount = 1;
+	}
+
+	//The pool finishes every job before it is destroyed
+	{
+		ThreadPool threadPool(threadCount);
+		for (unsigned long jobCounter = 0; jobCounter < jobCount; ++jobCounter) {
+			unsigned int seed = (unsigned int)(firstSeed + jobCounter);
+			threadPool.submit([=] { runJob(typeName, dimension, seed, startLocation, outputDirectory); });
+		}
+		threadPool.wait();
+	}
+
+	return failedJobs == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include "HeightPyramid.hpp"
+#include "TiledHeightMap.hpp"
+
+//This class edits the heights under a round brush. The brush is strongest at its center and falls off to nothing at its radius
+//following a falloff kernel. The heightmap is worked on one tile at a time and every run of cells in a tile row is done four at
+//a time with SSE, so only the cells under the brush are touched and the tiles that changed can be reported.
+class TerrainBrush {
+
+public:
+
+	enum Mode { RAISE, LOWER, SMOOTH, FLATTEN };
+
+	//Shape of the brush from its center to its radius: a smooth bell, a cone or a flat disc
+	enum Falloff { SMOOTH_FALLOFF, LINEAR_FALLOFF, CONSTANT_FALLOFF };
+
+private:
+
+	Mode mode;
+	Falloff falloff;
+	float radius, strength, flattenHeight;
+
+	//Brush weight of each cell in the run being edited
+	std::vector<float> weights;
+
+	//Heights under the brush before the stroke with a one cell border. Smoothing reads its neighbors from here so that the
+	//result does not depend on the order in which the tiles are done.
+	std::vector<float> originalHeights;
+
+	//Get the falloff kernel for a squared distance from the center divided by the squared radius
+	float getKernelWeight(float squaredDistanceRatio) {
+
+		if (squaredDistanceRatio > 1.0) {
+			return 0.0;
+		}
+		switch (this->falloff) {
+		case LINEAR_FALLOFF:
+			return 1.0 - std::sqrt(squaredDistanceRatio);
+		case CONSTANT_FALLOFF:
+			return 1.0;
+		default:
+			return (1.0 - squaredDistanceRatio) * (1.0 - squaredDistanceRatio);
+		}
+	}
+
+	//Get the brush weights for a run of cells in a row. The distances are in cells from the brush center.
+	void getRowWeights(float rowDistance, float firstColumnDistance, unsigned int count) {
+
+		float squaredRowDistance = rowDistance * rowDistance, inverseSquaredRadius = 1.0 / (this->radius * this->radius);
+		unsigned int cell = 0;
+
+#ifdef TERRAIN_USE_SSE
+		__m128 rowDistances = _mm_set1_ps(squaredRowDistance), inverseRadius = _mm_set1_ps(inverseSquaredRadius);
+		__m128 ones = _mm_set1_ps(1.0), zeros = _mm_setzero_ps(), strengths = _mm_set1_ps(this->strength), fours = _mm_set1_ps(4.0);
+		__m128 columnDistances = _mm_setr_ps(firstColumnDistance, firstColumnDistance + 1.0, firstColumnDistance + 2.0, firstColumnDistance + 3.0);
+		for (; cell + 4 <= count; cell += 4) {
+			__m128 ratios = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(columnDistances, columnDistances), rowDistances), inverseRadius), kernel;
+			switch (this->falloff) {
+			case LINEAR_FALLOFF:
+				kernel = _mm_max_ps(_mm_sub_ps(ones, _mm_sqrt_ps(ratios)), zeros);
+				break;
+			case CONSTANT_FALLOFF:
+				kernel = _mm_and_ps(_mm_cmple_ps(ratios, ones), ones);
+				break;
+			default:
+				kernel = _mm_max_ps(_mm_sub_ps(ones, ratios), zeros);
+				kernel = _mm_mul_ps(kernel, kernel);
+				break;
+			}
+			_mm_storeu_ps(&this->weights[cell], _mm_mul_ps(kernel, strengths));
+			columnDistances = _mm_add_ps(columnDistances, fours);
+		}
+#endif
+
+		for (; cell < count; ++cell) {
+			float columnDistance = firstColumnDistance + cell;
+			this->weights[cell] = this->strength * getKernelWeight((columnDistance * columnDistance + squaredRowDistance) * inverseSquaredRadius);
+		}
+	}
+
+	//Edit a run of heights with the weights of the run. The original heights point at the first cell of the run in the copy
+	//taken before the stroke, whose rows are rowStride apart.
+	void applyToRun(float* heights, const float* original, int rowStride, unsigned int count) {
+
+		const float* weights = this->weights.data();
+		unsigned int cell = 0;
+
+#ifdef TERRAIN_USE_SSE
+		__m128 ones = _mm_set1_ps(1.0), quarters = _mm_set1_ps(0.25), targets = _mm_set1_ps(this->flattenHeight);
+		for (; cell + 4 <= count; cell += 4) {
+			__m128 height = _mm_loadu_ps(heights + cell), weight = _mm_loadu_ps(weights + cell), target;
+			switch (this->mode) {
+			case RAISE:
+				_mm_storeu_ps(heights + cell, _mm_add_ps(height, weight));
+				continue;
+			case LOWER:
+				_mm_storeu_ps(heights + cell, _mm_sub_ps(height, weight));
+				continue;
+			case SMOOTH:
+				height = _mm_loadu_ps(original + cell);
+				target = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(original + cell - 1), _mm_loadu_ps(original + cell + 1)),
+					_mm_add_ps(_mm_loadu_ps(original + cell - rowStride), _mm_loadu_ps(original + cell + rowStride)));
+				target = _mm_mul_ps(target, quarters);
+				break;
+			default:
+				target = targets;
+				break;
+			}
+			//Move the height toward the target, never past it
+			weight = _mm_min_ps(weight, ones);
+			_mm_storeu_ps(heights + cell, _mm_add_ps(height, _mm_mul_ps(_mm_sub_ps(target, height), weight)));
+		}
+#endif
+
+		for (; cell < count; ++cell) {
+			switch (this->mode) {
+			case RAISE:
+				heights[cell] += weights[cell];
+				break;
+			case LOWER:
+				heights[cell] -= weights[cell];
+				break;
+			case SMOOTH: {
+				const float* center = original + cell;
+				float target = (center[-1] + center[1] + center[-rowStride] + center[rowStride]) * 0.25;
+				heights[cell] = original[cell] + (target - original[cell]) * std::min(weights[cell], 1.0f);
+				break;
+			}
+			default:
+				heights[cell] += (this->flattenHeight - heights[cell]) * std::min(weights[cell], 1.0f);
+				break;
+			}
+		}
+	}
+
+public:
+
+	//Constructor. The radius is in heightmap cells. Raising and lowering move the center of the brush by the strength on each
+	//stroke. Smoothing and flattening move it that fraction of the way to the target, so their strength should be up to 1.
+	TerrainBrush(Mode mode, float radius, float strength, Falloff falloff = SMOOTH_FALLOFF) {
+
+		if (radius <= 0.0) {
+			throw std::invalid_argument("Brush radius must be positive.");
+		}
+
+		this->mode = mode;
+		this->falloff = falloff;
+		this->radius = radius;
+		this->strength = strength;
+		this->flattenHeight = 0.0;
+		this->weights = std::vector<float>(TiledHeightMap::TILE_DIMENSION, 0.0);
+	}
+
+	Mode getMode() {
+		return this->mode;
+	}
+
+	void setMode(Mode mode) {
+		this->mode = mode;
+	}
+
+	float getRadius() {
+		return this->radius;
+	}
+
+	//Set the height that flattening moves the terrain toward, usually the height where the stroke started
+	void setFlattenHeight(float flattenHeight) {
+		this->flattenHeight = flattenHeight;
+	}
+
+	//Apply one stroke of the brush centered at a heightmap row and column. The rectangle of cells that can have changed and the
+	//tiles they are in are returned. Returns false if the brush is off the heightmap.
+	bool apply(TiledHeightMap& heightMap, float centerRow, float centerColumn, std::vector<TerrainTile>& changedTiles,
+		unsigned int& firstRow, unsigned int& firstColumn, unsigned int& lastRow, unsigned int& lastColumn) {
+
+		const unsigned int TILE_DIMENSION = TiledHeightMap::TILE_DIMENSION;
+		unsigned int dimension = heightMap.getDimension();
+		changedTiles.clear();
+
+		//Find the cells within the square around the brush
+		float lowestRow = std::ceil(centerRow - this->radius), highestRow = std::floor(centerRow + this->radius);
+		float lowestColumn = std::ceil(centerColumn - this->radius), highestColumn = std::floor(centerColumn + this->radius);
+		if (highestRow < 0.0 || highestColumn < 0.0 || lowestRow > dimension - 1.0 || lowestColumn > dimension - 1.0) {
+			return false;
+		}
+		firstRow = (unsigned int)std::max(lowestRow, 0.0f);
+		firstColumn = (unsigned int)std::max(lowestColumn, 0.0f);
+		lastRow = (unsigned int)std::min(highestRow, dimension - 1.0f);
+		lastColumn = (unsigned int)std::min(highestColumn, dimension - 1.0f);
+
+		//Copy the heights under the brush with a border, repeating the edge of the heightmap where the border is off it
+		unsigned int rowStride = lastColumn - firstColumn + 3;
+		if (this->mode == SMOOTH) {
+			this->originalHeights.resize(rowStride * (lastRow - firstRow + 3));
+			for (unsigned int row = 0; row < lastRow - firstRow + 3; ++row) {
+				unsigned int heightMapRow = std::min(std::max((int)(firstRow + row) - 1, 0), (int)dimension - 1);
+				for (unsigned int column = 0; column < rowStride; ++column) {
+					unsigned int heightMapColumn = std::min(std::max((int)(firstColumn + column) - 1, 0), (int)dimension - 1);
+					this->originalHeights[row * rowStride + column] = heightMap.get(heightMapRow, heightMapColumn);
+				}
+			}
+		}
+
+		float squaredRadius = this->radius * this->radius;
+		for (unsigned int tileRow = firstRow / TILE_DIMENSION; tileRow <= lastRow / TILE_DIMENSION; ++tileRow) {
+			for (unsigned int tileColumn = firstColumn / TILE_DIMENSION; tileColumn <= lastColumn / TILE_DIMENSION; ++tileColumn) {
+
+				unsigned int tileFirstRow = std::max(tileRow * TILE_DIMENSION, firstRow), tileLastRow = std::min(tileRow * TILE_DIMENSION + TILE_DIMENSION - 1, lastRow);
+				unsigned int tileFirstColumn = std::max(tileColumn * TILE_DIMENSION, firstColumn), tileLastColumn = std::min(tileColumn * TILE_DIMENSION + TILE_DIMENSION - 1, lastColumn);
+
+				//Skip the tiles in the corners of the square that the round brush does not reach
+				float nearestRow = std::min(std::max(centerRow, (float)tileFirstRow), (float)tileLastRow);
+				float nearestColumn = std::min(std::max(centerColumn, (float)tileFirstColumn), (float)tileLastColumn);
+				if ((nearestRow - centerRow) * (nearestRow - centerRow) + (nearestColumn - centerColumn) * (nearestColumn - centerColumn) > squaredRadius) {
+					continue;
+				}
+
+				//Writing to the tile makes it this heightmap's own if it is shared with a snapshot
+				float* tileHeights = heightMap.getWritableTile(tileRow, tileColumn);
+				for (unsigned int row = tileFirstRow; row <= tileLastRow; ++row) {
+
+					//Only the cells of the row within the radius are edited
+					float rowDistance = row - centerRow, halfWidth = std::sqrt(std::max(squaredRadius - rowDistance * rowDistance, 0.0f));
+					float runStart = std::max(std::ceil(centerColumn - halfWidth), (float)tileFirstColumn), runEnd = std::min(std::floor(centerColumn + halfWidth), (float)tileLastColumn);
+					if (runStart > runEnd) {
+						continue;
+					}
+					unsigned int runFirstColumn = (unsigned int)runStart, runCount = (unsigned int)runEnd - runFirstColumn + 1;
+
+					getRowWeights(rowDistance, runFirstColumn - centerColumn, runCount);
+					const float* original = this->mode == SMOOTH ? &this->originalHeights[(row - firstRow + 1) * rowStride + runFirstColumn - firstColumn + 1] : NULL;
+					applyToRun(tileHeights + (row % TILE_DIMENSION) * TILE_DIMENSION + runFirstColumn % TILE_DIMENSION, original, rowStride, runCount);
+				}
+
+				TerrainTile tile = { tileRow, tileColumn };
+				changedTiles.push_back(tile);
+			}
+		}
+		return true;
+	}
+
+};
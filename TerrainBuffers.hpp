@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include "Angel.h"
+
+//Mapped vertex and index buffers of one terrain mesh. The mesh builder writes straight into the mapped pointers.
+struct TerrainBufferSet {
+	GLuint vertexBuffer, textureBuffer, normalBuffer, indexBuffer;
+	unsigned int vertexCapacity, indexCapacity, indexCount;
+	GLsync fence;
+	vec3* vertices;
+	vec2* textureCoordinates;
+	vec3* normals;
+	int* indices;
+};
+
+//This class keeps two sets of terrain buffers. One set is drawn while a new terrain is written into the other, and the sets
+//swap when the upload ends. The buffers are mapped persistently when the driver supports it, so the CPU never holds its own
+//copy of the mesh. Otherwise they are mapped for each upload.
+class TerrainBuffers {
+
+private:
+
+	TerrainBufferSet bufferSets[2];
+
+	//Set being drawn, or -1 before the first upload
+	int drawnSet;
+
+	bool persistentMapping;
+
+	//Vertex attribute locations in the shader program
+	GLuint vPosition, tPosition, nPosition;
+
+	//Allocate and map a buffer. Persistent buffers keep their storage, so a bigger mesh gets a new buffer. Their storage is
+	//dynamic so that edits can still be uploaded with glBufferSubData.
+	void* allocateBuffer(GLenum target, GLuint& buffer, GLsizeiptr size) {
+
+#ifdef GL_MAP_PERSISTENT_BIT
+		if (this->persistentMapping) {
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			glBindBuffer(target, buffer);
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(target, size, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+			return glMapBufferRange(target, 0, size, flags);
+		}
+#endif
+		glBindBuffer(target, buffer);
+		glBufferData(target, size, NULL, GL_STATIC_DRAW);
+		return NULL;
+	}
+
+	//Map a buffer for writing a new mesh when it is not persistently mapped
+	void* mapBuffer(GLenum target, GLuint buffer, GLsizeiptr size) {
+
+		glBindBuffer(target, buffer);
+		return glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	}
+
+	//Unmap a buffer after a mesh has been written when it is not persistently mapped
+	void unmapBuffer(GLenum target, GLuint buffer) {
+
+		glBindBuffer(target, buffer);
+		glUnmapBuffer(target);
+	}
+
+	//Wait until the GPU has finished drawing from the set
+	void waitForSet(TerrainBufferSet& bufferSet) {
+
+		if (bufferSet.fence != 0) {
+			while (glClientWaitSync(bufferSet.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+			}
+			glDeleteSync(bufferSet.fence);
+			bufferSet.fence = 0;
+		}
+	}
+
+public:
+
+	//Constructor. Needs the shader program the mesh is drawn with.
+	TerrainBuffers(GLuint program) {
+
+		this->drawnSet = -1;
+#ifdef GLEW_ARB_buffer_storage
+		this->persistentMapping = GLEW_ARB_buffer_storage != 0;
+#else
+		this->persistentMapping = false;
+#endif
+
+		for (unsigned int setCounter = 0; setCounter < 2; ++setCounter) {
+			TerrainBufferSet& bufferSet = this->bufferSets[setCounter];
+			glGenBuffers(1, &bufferSet.vertexBuffer);
+			glGenBuffers(1, &bufferSet.textureBuffer);
+			glGenBuffers(1, &bufferSet.normalBuffer);
+			glGenBuffers(1, &bufferSet.indexBuffer);
+			bufferSet.vertexCapacity = bufferSet.indexCapacity = bufferSet.indexCount = 0;
+			bufferSet.fence = 0;
+			bufferSet.vertices = bufferSet.normals = NULL;
+			bufferSet.textureCoordinates = NULL;
+			bufferSet.indices = NULL;
+		}
+
+		this->vPosition = glGetAttribLocation(program, "vPosition");
+		this->tPosition = glGetAttribLocation(program, "tPosition");
+		this->nPosition = glGetAttribLocation(program, "nPosition");
+		glEnableVertexAttribArray(this->vPosition);
+		glEnableVertexAttribArray(this->tPosition);
+		glEnableVertexAttribArray(this->nPosition);
+	}
+
+	//Get a set of buffers that is not being drawn, mapped for writing a mesh of the given size. The pointers in the set can be
+	//written from any thread until endUpload is called. Must be called on the thread that owns the GL context.
+	TerrainBufferSet& beginUpload(unsigned int vertexCount, unsigned int indexCount) {
+
+		TerrainBufferSet& bufferSet = this->bufferSets[this->drawnSet == 0 ? 1 : 0];
+		waitForSet(bufferSet);
+
+		if (vertexCount > bufferSet.vertexCapacity || indexCount > bufferSet.indexCapacity) {
+			bufferSet.vertexCapacity = std::max(vertexCount, bufferSet.vertexCapacity);
+			bufferSet.indexCapacity = std::max(indexCount, bufferSet.indexCapacity);
+			bufferSet.vertices = (vec3*)allocateBuffer(GL_ARRAY_BUFFER, bufferSet.vertexBuffer, bufferSet.vertexCapacity * sizeof(vec3));
+			bufferSet.textureCoordinates = (vec2*)allocateBuffer(GL_ARRAY_BUFFER, bufferSet.textureBuffer, bufferSet.vertexCapacity * sizeof(vec2));
+			bufferSet.normals = (vec3*)allocateBuffer(GL_ARRAY_BUFFER, bufferSet.normalBuffer, bufferSet.vertexCapacity * sizeof(vec3));
+			bufferSet.indices = (int*)allocateBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferSet.indexBuffer, bufferSet.indexCapacity * sizeof(int));
+		}
+
+		if (!this->persistentMapping) {
+			bufferSet.vertices = (vec3*)mapBuffer(GL_ARRAY_BUFFER, bufferSet.vertexBuffer, vertexCount * sizeof(vec3));
+			bufferSet.textureCoordinates = (vec2*)mapBuffer(GL_ARRAY_BUFFER, bufferSet.textureBuffer, vertexCount * sizeof(vec2));
+			bufferSet.normals = (vec3*)mapBuffer(GL_ARRAY_BUFFER, bufferSet.normalBuffer, vertexCount * sizeof(vec3));
+			bufferSet.indices = (int*)mapBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferSet.indexBuffer, indexCount * sizeof(int));
+		}
+
+		bufferSet.indexCount = indexCount;
+		return bufferSet;
+	}
+
+	//Finish writing the set returned by beginUpload and draw it from now on. Must be called on the thread that owns the GL context.
+	void endUpload() {
+
+		int uploadedSet = this->drawnSet == 0 ? 1 : 0;
+		TerrainBufferSet& bufferSet = this->bufferSets[uploadedSet];
+
+		if (!this->persistentMapping) {
+			unmapBuffer(GL_ARRAY_BUFFER, bufferSet.vertexBuffer);
+			unmapBuffer(GL_ARRAY_BUFFER, bufferSet.textureBuffer);
+			unmapBuffer(GL_ARRAY_BUFFER, bufferSet.normalBuffer);
+			unmapBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferSet.indexBuffer);
+			bufferSet.vertices = bufferSet.normals = NULL;
+			bufferSet.textureCoordinates = NULL;
+			bufferSet.indices = NULL;
+		}
+
+		//Point the vertex attributes at the new set
+		this->drawnSet = uploadedSet;
+		glBindBuffer(GL_ARRAY_BUFFER, bufferSet.vertexBuffer);
+		glVertexAttribPointer(this->vPosition, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+		glBindBuffer(GL_ARRAY_BUFFER, bufferSet.textureBuffer);
+		glVertexAttribPointer(this->tPosition, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+		glBindBuffer(GL_ARRAY_BUFFER, bufferSet.normalBuffer);
+		glVertexAttribPointer(this->nPosition, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferSet.indexBuffer);
+	}
+
+	//Replace a run of vertices of the mesh being drawn. glBufferSubData lets the driver wait for the frames still reading them.
+	//Must be called on the thread that owns the GL context.
+	void updateVertices(unsigned int firstVertex, unsigned int vertexCount, const vec3* vertices, const vec2* textureCoordinates, const vec3* normals) {
+
+		if (this->drawnSet < 0) {
+			return;
+		}
+
+		TerrainBufferSet& bufferSet = this->bufferSets[this->drawnSet];
+		glBindBuffer(GL_ARRAY_BUFFER, bufferSet.vertexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, firstVertex * sizeof(vec3), vertexCount * sizeof(vec3), vertices);
+		glBindBuffer(GL_ARRAY_BUFFER, bufferSet.textureBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, firstVertex * sizeof(vec2), vertexCount * sizeof(vec2), textureCoordinates);
+		glBindBuffer(GL_ARRAY_BUFFER, bufferSet.normalBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, firstVertex * sizeof(vec3), vertexCount * sizeof(vec3), normals);
+	}
+
+	//Has a mesh been uploaded
+	bool hasMesh() {
+		return this->drawnSet >= 0;
+	}
+
+	//Draw the current mesh. A fence marks when the GPU is done with its buffers so that they are not overwritten too early.
+	void draw() {
+
+		if (this->drawnSet < 0) {
+			return;
+		}
+
+		//An upload in progress leaves the index buffer of the other set bound, and it may still be mapped or partly written
+		TerrainBufferSet& bufferSet = this->bufferSets[this->drawnSet];
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferSet.indexBuffer);
+		glDrawElements(GL_TRIANGLES, bufferSet.indexCount, GL_UNSIGNED_INT, BUFFER_OFFSET(0));
+
+		if (this->persistentMapping) {
+			if (bufferSet.fence != 0) {
+				glDeleteSync(bufferSet.fence);
+			}
+			bufferSet.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+};
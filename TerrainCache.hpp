@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include "HeightMapFile.hpp"
+#include "TerrainFactory.hpp"
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+//This class keeps generated terrains in a directory on disk so that asking for the same terrain again maps the saved heights
+//instead of generating them. A terrain is found by a hash of its generator, dimension, generator constants and seed, which
+//together decide every height, so a change to any of them makes a different terrain.
+class TerrainCache {
+
+private:
+
+	//Changed whenever a generator makes different heights from the same constants and seed, which leaves the old files unused
+	static const unsigned int CACHE_VERSION = 2;
+
+	std::string directory;
+
+	//Hash the key of a terrain (64 bit FNV-1a)
+	static unsigned long long hashKey(const std::string& key) {
+
+		unsigned long long hash = 14695981039346656037ULL;
+		for (size_t character = 0; character < key.size(); ++character) {
+			hash = (hash ^ (unsigned char)key[character]) * 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	//Get the key of a terrain that has been constructed but not necessarily made
+	static std::string getKey(Terrain& terrain) {
+
+		std::stringstream key;
+		key << CACHE_VERSION << "|" << terrain.getGeneratorName() << "|" << terrain.getTerrainDimension() << "|" <<
+			terrain.getGeneratorParameters() << "|" << terrain.getSeed();
+		return key.str();
+	}
+
+public:
+
+	//Constructor. The directory is made if it does not exist.
+	TerrainCache(const std::string& directory) {
+
+		this->directory = directory;
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+	}
+
+	//Get the file a terrain is kept in
+	std::string getFileName(Terrain& terrain) {
+
+		std::stringstream fileName;
+		fileName << this->directory << "/" << terrain.getGeneratorName() << "_" << std::hex << hashKey(getKey(terrain)) << ".thm";
+		return fileName.str();
+	}
+
+	//Get a terrain of a type given by name, as TerrainFactory knows it. It is mapped from the cache if it is there, and
+	//otherwise made and saved to the cache. A cache that cannot be written only means that the terrain is made again next time.
+	std::shared_ptr<Terrain> get(const std::string& typeName, unsigned int dimension, unsigned int seed, char startLocation, bool& cached) {
+
+		std::shared_ptr<Terrain> terrain = TerrainFactory::construct(typeName, dimension, seed, startLocation);
+		std::string fileName = getFileName(*terrain);
+
+		//The file records the key, so a file whose name comes from a colliding hash is never taken for the terrain
+		std::shared_ptr<Terrain> cachedTerrain = HeightMapFile::loadTerrain(fileName);
+		if (cachedTerrain && getKey(*cachedTerrain) == getKey(*terrain)) {
+			cached = true;
+			return cachedTerrain;
+		}
+
+		cached = false;
+		terrain->generateTerrain();
+		HeightMapFile::save(fileName, *terrain);
+		return terrain;
+	}
+
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "Terrain.hpp"
+
+//This class makes a terrain of a type given by name. It needs nothing from OpenGL, so tools without a display can make the
+//same terrains as the viewer.
+class TerrainFactory {
+
+public:
+
+	//Is this the name of a type of terrain
+	static bool isValidType(const std::string& typeName) {
+		return typeName == "deposition" || typeName == "rolldown" || typeName == "squarediamond" || typeName == "stepfault" ||
+			typeName == "bump";
+	}
+
+	//Make a terrain without its heights, which makeTerrain fills in. The start location is only used by the particle deposition
+	//terrains, where 'r' starts the deposition at a random point instead of the center.
+	static std::shared_ptr<Terrain> construct(const std::string& typeName, unsigned int dimension, unsigned int seed, char startLocation) {
+
+		if (typeName == "deposition") {
+			return std::shared_ptr<Terrain>(new ParticleDepositionTerrain(dimension, startLocation, seed));
+		}
+		else if (typeName == "rolldown") {
+			return std::shared_ptr<Terrain>(new RollDownParticleDepositionTerrain(dimension, startLocation, seed));
+		}
+		else if (typeName == "squarediamond") {
+			return std::shared_ptr<Terrain>(new SquareDiamondTerrain(dimension, seed));
+		}
+		else if (typeName == "stepfault") {
+			return std::shared_ptr<Terrain>(new StepFaultTerrain(dimension, seed));
+		}
+		else if (typeName == "bump") {
+			return std::shared_ptr<Terrain>(new BumpTerrain(dimension, seed));
+		}
+		else {
+			throw std::invalid_argument("Unknown terrain type " + typeName + ".");
+		}
+	}
+
+	//Make a terrain and its heights
+	static std::shared_ptr<Terrain> create(const std::string& typeName, unsigned int dimension, unsigned int seed, char startLocation) {
+
+		std::shared_ptr<Terrain> terrain = construct(typeName, dimension, seed, startLocation);
+		terrain->generateTerrain();
+		return terrain;
+	}
+
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "HeightBandSink.hpp"
+#include "Terrain.hpp"
+
+//This class makes the heights of a terrain a band of rows at a time and pushes each band to sinks such as HeightMapFile and
+//MeshExporter writers, for the terrains whose rows depend only on the constants of their generator, like the fault and bump
+//terrains. Only two bands are held at once, the one the sinks are taking and the next one being made, so the memory used
+//grows with the width of the terrain and not its area. Each band is split into rows made on separate threads.
+class TerrainStreamer {
+
+private:
+
+	//Number of rows in a band, which is one row of heightmap tiles
+	static const unsigned int BAND_ROWS = TiledHeightMap::TILE_DIMENSION;
+
+	//Smallest number of heights worth giving a thread of its own
+	static const unsigned int HEIGHTS_PER_THREAD = 65536;
+
+	//Finds the lowest and highest heights
+	class HeightRangeSink : public HeightBandSink {
+
+	public:
+
+		unsigned int dimension;
+		float minHeight, maxHeight;
+
+		HeightRangeSink(unsigned int dimension) {
+			this->dimension = dimension;
+			this->minHeight = std::numeric_limits<float>::max();
+			this->maxHeight = -std::numeric_limits<float>::max();
+		}
+
+		bool takeBand(unsigned int /*firstRow*/, unsigned int rowCount, const float* heights) {
+
+			size_t heightCount = (size_t)rowCount * this->dimension;
+			this->minHeight = std::min(this->minHeight, *std::min_element(heights, heights + heightCount));
+			this->maxHeight = std::max(this->maxHeight, *std::max_element(heights, heights + heightCount));
+			return true;
+		}
+
+		bool finish() {
+			return true;
+		}
+
+	};
+
+	//Make a band of rows, split into smaller bands made on the given number of threads, or one for every core
+	static void makeBand(Terrain* terrain, unsigned int firstRow, unsigned int rowCount, float* heights, unsigned int threadCount) {
+
+		unsigned int dimension = terrain->getTerrainDimension();
+		if (threadCount == 0) {
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		threadCount = (unsigned int)std::max(std::min((size_t)threadCount, (size_t)rowCount * dimension / HEIGHTS_PER_THREAD), (size_t)1);
+		unsigned int threadRows = (rowCount + threadCount - 1) / threadCount;
+
+		//This thread makes the first rows
+		std::vector<std::thread> threads;
+		for (unsigned int threadFirstRow = threadRows; threadFirstRow < rowCount; threadFirstRow += threadRows) {
+			threads.push_back(std::thread(&Terrain::makeRows, terrain, firstRow + threadFirstRow, std::min(threadRows, rowCount - threadFirstRow),
+				heights + (size_t)threadFirstRow * dimension));
+		}
+		terrain->makeRows(firstRow, std::min(threadRows, rowCount), heights);
+		for (unsigned int threadCounter = 0; threadCounter < threads.size(); ++threadCounter) {
+			threads[threadCounter].join();
+		}
+	}
+
+public:
+
+	//Stream the heights of a terrain that can make its rows to every sink, then finish the sinks. The terrain's own heightmap
+	//is left as it is. The rows are made on the given number of threads, or one for every core. Returns false if any sink failed,
+	//and throws std::invalid_argument if the terrain cannot make its rows.
+	static bool stream(Terrain& terrain, const std::vector<HeightBandSink*>& sinks, unsigned int threadCount = 0) {
+
+		if (!terrain.canMakeRows()) {
+			throw std::invalid_argument(terrain.getGeneratorName() + " terrains cannot be made a band of rows at a time.");
+		}
+
+		unsigned int dimension = terrain.getTerrainDimension();
+		std::vector<float> band((size_t)BAND_ROWS * dimension), nextBand((size_t)BAND_ROWS * dimension);
+		makeBand(&terrain, 0, std::min((unsigned int)BAND_ROWS, dimension), band.data(), threadCount);
+
+		//The next band is made while the sinks take this one
+		bool streamed = true;
+		for (unsigned int firstRow = 0; firstRow < dimension && streamed; firstRow += BAND_ROWS) {
+
+			unsigned int rowCount = std::min((unsigned int)BAND_ROWS, dimension - firstRow), nextFirstRow = firstRow + BAND_ROWS;
+			std::thread nextBandMaker;
+			if (nextFirstRow < dimension) {
+				nextBandMaker = std::thread(makeBand, &terrain, nextFirstRow, std::min((unsigned int)BAND_ROWS, dimension - nextFirstRow), nextBand.data(),
+					threadCount);
+			}
+			for (unsigned int sinkCounter = 0; sinkCounter < sinks.size() && streamed; ++sinkCounter) {
+				streamed = sinks[sinkCounter]->takeBand(firstRow, rowCount, band.data());
+			}
+			if (nextBandMaker.joinable()) {
+				nextBandMaker.join();
+			}
+			band.swap(nextBand);
+		}
+
+		//Every sink is finished, even after a failure, so that none is left with a partly written file
+		for (unsigned int sinkCounter = 0; sinkCounter < sinks.size(); ++sinkCounter) {
+			streamed = sinks[sinkCounter]->finish() && streamed;
+		}
+		return streamed;
+	}
+
+	//Stream the heights of a terrain to one sink
+	static bool stream(Terrain& terrain, HeightBandSink& sink, unsigned int threadCount = 0) {
+		return stream(terrain, std::vector<HeightBandSink*>(1, &sink), threadCount);
+	}
+
+	//Find the lowest and highest heights of a terrain that can make its rows, without holding its heights
+	static void findHeightRange(Terrain& terrain, float& minHeight, float& maxHeight, unsigned int threadCount = 0) {
+
+		HeightRangeSink rangeSink(terrain.getTerrainDimension());
+		stream(terrain, rangeSink, threadCount);
+		minHeight = rangeSink.minHeight;
+		maxHeight = rangeSink.maxHeight;
+	}
+
+};
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "MappedFile.hpp"
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#ifndef TERRAIN_USE_SSSE3
+#define TERRAIN_USE_SSSE3
+#endif
+#endif
+
+//This class loads an uncompressed 24 or 32 bit BMP image as RGBA with its whole mipmap chain, ready to be uploaded one level at
+//a time. The rows go from the bottom of the image to the top, which is the order OpenGL expects. The first load of an image
+//parses the BMP and box filters the mipmaps on several threads, then saves the levels in a cache file next to the image. Later
+//loads map the cache file and hand out pointers into the mapping, so the levels are never copied on the CPU.
+class TextureImage {
+
+private:
+
+	//Changed whenever the layout of the cache file changes
+	static const unsigned int CACHE_VERSION = 1;
+
+	//Smallest number of mipmap pixels worth giving a thread of its own
+	static const unsigned int PIXELS_PER_THREAD = 65536;
+
+	//Start of a cache file. The levels follow it one after the other with no padding.
+	struct CacheHeader {
+		char magic[4];
+		unsigned int version, width, height, levelCount, reserved;
+		unsigned long long imageSize, imageTime;
+	};
+
+	unsigned int width, height;
+
+	//Byte offset of each level, followed by the size of all of them
+	std::vector<size_t> levelOffsets;
+
+	//Levels built from the image, or the cache file they were loaded from
+	std::vector<unsigned char> pixels;
+	MappedFile cacheFile;
+	const unsigned char* levels;
+
+	//Read a little endian number from the BMP headers
+	static unsigned int readLittleEndian(const unsigned char* bytes, unsigned int byteCount) {
+
+		unsigned int value = 0;
+		for (unsigned int byte = 0; byte < byteCount; ++byte) {
+			value |= (unsigned int)bytes[byte] << (8 * byte);
+		}
+		return value;
+	}
+
+	//Find where each level starts for the current width and height
+	void setLevelOffsets() {
+
+		this->levelOffsets.assign(1, 0);
+		for (unsigned int level = 0; level == 0 || (getLevelWidth(level - 1) > 1 || getLevelHeight(level - 1) > 1); ++level) {
+			this->levelOffsets.push_back(this->levelOffsets.back() + 4 * (size_t)getLevelWidth(level) * getLevelHeight(level));
+		}
+	}
+
+	//Turn a row of BGR or BGRA pixels into RGBA, with the alpha always opaque
+	static void swizzleRow(const unsigned char* source, unsigned int rowWidth, unsigned int bytesPerPixel, size_t sourceBytesLeft, unsigned char* destination) {
+
+		unsigned int column = 0;
+
+#ifdef TERRAIN_USE_SSSE3
+		//Four pixels at a time, as long as the 16 bytes read are all in the file
+		__m128i shuffle = bytesPerPixel == 3 ? _mm_setr_epi8(2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128) :
+			_mm_setr_epi8(2, 1, 0, -128, 6, 5, 4, -128, 10, 9, 8, -128, 14, 13, 12, -128);
+		__m128i opaque = _mm_set1_epi32(0xFF000000);
+		for (; column + 4 <= rowWidth && (size_t)column * bytesPerPixel + 16 <= sourceBytesLeft; column += 4) {
+			__m128i sourcePixels = _mm_loadu_si128((const __m128i*)(source + column * bytesPerPixel));
+			_mm_storeu_si128((__m128i*)(destination + 4 * column), _mm_or_si128(_mm_shuffle_epi8(sourcePixels, shuffle), opaque));
+		}
+#else
+		(void)sourceBytesLeft;
+#endif
+
+		for (; column < rowWidth; ++column) {
+			const unsigned char* sourcePixel = source + column * bytesPerPixel;
+			unsigned char* destinationPixel = destination + 4 * column;
+			destinationPixel[0] = sourcePixel[2];
+			destinationPixel[1] = sourcePixel[1];
+			destinationPixel[2] = sourcePixel[0];
+			destinationPixel[3] = 255;
+		}
+	}
+
+	//Parse a BMP file into the first level. Returns false if it is not a BMP that can be read.
+	bool readBmp(const char* fileName) {
+
+		MappedFile bmpFile;
+		if (!bmpFile.open(fileName) || bmpFile.getSize() < 54) {
+			return false;
+		}
+
+		const unsigned char* bytes = bmpFile.getData();
+		size_t pixelOffset = readLittleEndian(bytes + 10, 4);
+		int imageWidth = (int)readLittleEndian(bytes + 18, 4), imageHeight = (int)readLittleEndian(bytes + 22, 4);
+		unsigned int bitsPerPixel = readLittleEndian(bytes + 28, 2), compression = readLittleEndian(bytes + 30, 4);
+		if (bytes[0] != 'B' || bytes[1] != 'M' || readLittleEndian(bytes + 14, 4) < 40 || (bitsPerPixel != 24 && bitsPerPixel != 32) ||
+			compression != 0 || imageWidth <= 0 || imageHeight == 0) {
+			return false;
+		}
+
+		//Rows are padded to four bytes. A negative height means the rows go from the top down.
+		unsigned int bytesPerPixel = bitsPerPixel / 8, rowCount = imageHeight > 0 ? imageHeight : -imageHeight;
+		size_t rowStride = ((size_t)imageWidth * bytesPerPixel + 3) & ~(size_t)3;
+		if (pixelOffset + rowStride * rowCount > bmpFile.getSize()) {
+			return false;
+		}
+
+		this->width = imageWidth;
+		this->height = rowCount;
+		setLevelOffsets();
+		this->pixels.resize(this->levelOffsets.back());
+		for (unsigned int row = 0; row < this->height; ++row) {
+			size_t sourceOffset = pixelOffset + rowStride * (imageHeight > 0 ? row : this->height - 1 - row);
+			swizzleRow(bytes + sourceOffset, this->width, bytesPerPixel, bmpFile.getSize() - sourceOffset, &this->pixels[4 * (size_t)row * this->width]);
+		}
+		return true;
+	}
+
+	//Box filter a band of rows of a level from the level above it. Where the level above has an odd size the last row or
+	//column is left out.
+	static void filterRows(const unsigned char* source, unsigned int sourceWidth, unsigned int sourceHeight, unsigned char* destination,
+		unsigned int destinationWidth, unsigned int firstRow, unsigned int lastRow) {
+
+		for (unsigned int row = firstRow; row <= lastRow; ++row) {
+			const unsigned char* top = source + 4 * (size_t)std::min(2 * row, sourceHeight - 1) * sourceWidth;
+			const unsigned char* bottom = source + 4 * (size_t)std::min(2 * row + 1, sourceHeight - 1) * sourceWidth;
+			unsigned char* destinationPixel = destination + 4 * (size_t)row * destinationWidth;
+			for (unsigned int column = 0; column < destinationWidth; ++column) {
+				unsigned int left = 4 * std::min(2 * column, sourceWidth - 1), right = 4 * std::min(2 * column + 1, sourceWidth - 1);
+				for (unsigned int channel = 0; channel < 4; ++channel) {
+					*destinationPixel++ = (top[left + channel] + top[right + channel] + bottom[left + channel] + bottom[right + channel] + 2) / 4;
+				}
+			}
+		}
+	}
+
+	//Fill in every level below the first one. Each level is split into bands of rows filtered on separate threads.
+	void buildMipmaps() {
+
+		for (unsigned int level = 1; level < getLevelCount(); ++level) {
+
+			const unsigned char* source = &this->pixels[this->levelOffsets[level - 1]];
+			unsigned char* destination = &this->pixels[this->levelOffsets[level]];
+			unsigned int levelWidth = getLevelWidth(level), levelHeight = getLevelHeight(level);
+
+			unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+			threadCount = std::max(std::min(threadCount, levelWidth * levelHeight / PIXELS_PER_THREAD), 1u);
+			unsigned int bandRows = (levelHeight + threadCount - 1) / threadCount;
+
+			std::vector<std::thread> threads;
+			for (unsigned int bandFirstRow = bandRows; bandFirstRow < levelHeight; bandFirstRow += bandRows) {
+				threads.push_back(std::thread(filterRows, source, getLevelWidth(level - 1), getLevelHeight(level - 1), destination, levelWidth,
+					bandFirstRow, std::min(bandFirstRow + bandRows, levelHeight) - 1));
+			}
+			filterRows(source, getLevelWidth(level - 1), getLevelHeight(level - 1), destination, levelWidth, 0, std::min(bandRows, levelHeight) - 1);
+			for (unsigned int threadCounter = 0; threadCounter < threads.size(); ++threadCounter) {
+				threads[threadCounter].join();
+			}
+		}
+		this->levels = this->pixels.data();
+	}
+
+	//Map the cache file if it was made from the image as it is now. Returns false if it has to be built again.
+	bool readCache(const std::string& cacheName, unsigned long long imageSize, unsigned long long imageTime) {
+
+		if (!this->cacheFile.open(cacheName.c_str()) || this->cacheFile.getSize() < sizeof(CacheHeader)) {
+			this->cacheFile.close();
+			return false;
+		}
+
+		CacheHeader header;
+		std::memcpy(&header, this->cacheFile.getData(), sizeof(CacheHeader));
+		this->width = header.width;
+		this->height = header.height;
+		if (std::memcmp(header.magic, "TXIC", 4) != 0 || header.version != CACHE_VERSION || header.imageSize != imageSize ||
+			header.imageTime != imageTime || this->width == 0 || this->height == 0) {
+			this->cacheFile.close();
+			return false;
+		}
+
+		setLevelOffsets();
+		if (header.levelCount != getLevelCount() || this->cacheFile.getSize() != sizeof(CacheHeader) + this->levelOffsets.back()) {
+			this->cacheFile.close();
+			return false;
+		}
+		this->levels = this->cacheFile.getData() + sizeof(CacheHeader);
+		return true;
+	}
+
+	//Save the levels for the next load. A cache that cannot be written only means that the next load builds them again.
+	void writeCache(const std::string& cacheName, unsigned long long imageSize, unsigned long long imageTime) {
+
+		CacheHeader header;
+		std::memset(&header, 0, sizeof(CacheHeader));
+		std::memcpy(header.magic, "TXIC", 4);
+		header.version = CACHE_VERSION;
+		header.width = this->width;
+		header.height = this->height;
+		header.levelCount = getLevelCount();
+		header.imageSize = imageSize;
+		header.imageTime = imageTime;
+
+		FILE* file = fopen(cacheName.c_str(), "wb");
+		if (file == NULL) {
+			return;
+		}
+		bool written = fwrite(&header, sizeof(CacheHeader), 1, file) == 1 && fwrite(this->pixels.data(), this->pixels.size(), 1, file) == 1;
+		fclose(file);
+		if (!written) {
+			remove(cacheName.c_str());
+		}
+	}
+
+public:
+
+	//Constructor for an image that has not been loaded
+	TextureImage() {
+		this->width = this->height = 0;
+		this->levels = NULL;
+	}
+
+	//Load a BMP image with its mipmaps, from its cache file if it is up to date. Returns false if the image cannot be read.
+	bool load(const char* fileName) {
+
+		this->pixels.clear();
+		this->cacheFile.close();
+		this->levels = NULL;
+
+		struct stat imageStatus;
+		if (stat(fileName, &imageStatus) != 0) {
+			return false;
+		}
+		unsigned long long imageSize = imageStatus.st_size, imageTime = imageStatus.st_mtime;
+
+		std::string cacheName = std::string(fileName) + ".mipmaps";
+		if (readCache(cacheName, imageSize, imageTime)) {
+			return true;
+		}
+		if (!readBmp(fileName)) {
+			return false;
+		}
+		buildMipmaps();
+		writeCache(cacheName, imageSize, imageTime);
+		return true;
+	}
+
+	//Was the image loaded from its cache file
+	bool isCached() const {
+		return this->cacheFile.isOpen();
+	}
+
+	unsigned int getLevelCount() const {
+		return this->levelOffsets.size() - 1;
+	}
+
+	unsigned int getLevelWidth(unsigned int level) const {
+		return std::max(this->width >> level, 1u);
+	}
+
+	unsigned int getLevelHeight(unsigned int level) const {
+		return std::max(this->height >> level, 1u);
+	}
+
+	//Get the RGBA pixels of a level, one row after the other from the bottom of the image
+	const unsigned char* getLevel(unsigned int level) const {
+		return this->levels + this->levelOffsets[level];
+	}
+
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//This class runs jobs on a fixed set of threads. Jobs are taken in the order they were added by whichever thread is free first.
+class ThreadPool {
+
+private:
+
+	std::vector<std::thread> workers;
+
+	//Jobs not started yet and the number being run
+	std::deque<std::function<void()> > jobs;
+	unsigned int runningJobs;
+	bool stopping;
+
+	std::mutex jobMutex;
+	std::condition_variable jobAdded, jobsFinished;
+
+	//A pool owns its threads
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	//Run jobs until the pool is stopped
+	void work() {
+
+		std::unique_lock<std::mutex> lock(this->jobMutex);
+		while (true) {
+			this->jobAdded.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+			if (this->jobs.empty()) {
+				return;
+			}
+
+			std::function<void()> job = this->jobs.front();
+			this->jobs.pop_front();
+			++this->runningJobs;
+			lock.unlock();
+			job();
+			lock.lock();
+			--this->runningJobs;
+			if (this->jobs.empty() && this->runningJobs == 0) {
+				this->jobsFinished.notify_all();
+			}
+		}
+	}
+
+public:
+
+	//Constructor. With no thread count there is a thread for every core.
+	ThreadPool(unsigned int threadCount = 0) {
+
+		this->runningJobs = 0;
+		this->stopping = false;
+		if (threadCount == 0) {
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		for (unsigned int threadCounter = 0; threadCounter < threadCount; ++threadCounter) {
+			this->workers.push_back(std::thread(&ThreadPool::work, this));
+		}
+	}
+
+	//Finish the jobs that were added and stop the threads
+	~ThreadPool() {
+
+		{
+			std::lock_guard<std::mutex> lock(this->jobMutex);
+			this->stopping = true;
+		}
+		this->jobAdded.notify_all();
+		for (unsigned int threadCounter = 0; threadCounter < this->workers.size(); ++threadCounter) {
+			this->workers[threadCounter].join();
+		}
+	}
+
+	//Add a job to be run. Jobs must not throw.
+	void submit(const std::function<void()>& job) {
+
+		{
+			std::lock_guard<std::mutex> lock(this->jobMutex);
+			this->jobs.push_back(job);
+		}
+		this->jobAdded.notify_one();
+	}
+
+	//Wait until every job added so far has finished
+	void wait() {
+
+		std::unique_lock<std::mutex> lock(this->jobMutex);
+		this->jobsFinished.wait(lock, [this] { return this->jobs.empty() && this->runningJobs == 0; });
+	}
+
+	unsigned int getThreadCount() const {
+		return this->workers.size();
+	}
+
+};
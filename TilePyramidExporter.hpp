@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AsyncFileWriter.hpp"
+#include "HeightPyramid.hpp"
+#include "ThreadPool.hpp"
+#include "TiledHeightMap.hpp"
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+//This class exports a heightmap as a pyramid of square tiles for map viewers and streaming. The finest zoom level is the
+//heightmap itself and every level above is half its size, down to zoom level 0 which is a single tile. Each level is reduced
+//from the one below with a 1-2-1 tent filter on several threads, four heights at a time with SSE. A tile has one more height
+//than it has cells on each side, so neighboring tiles share their edge heights and meet without cracks. Tiles are written as
+//raw 32 bit floats, one row after the other, to <directory>/<zoom>/<column>/<row>.raw. The tile rows of every level are jobs
+//on a thread pool, and each job keeps several files being written at once with AsyncFileWriter.
+class TilePyramidExporter {
+
+private:
+
+	//Number of cells on each side of a tile, unless the heightmap is smaller
+	static const unsigned int TILE_CELLS = 256;
+
+	//Number of tiles each job has being written at once
+	static const unsigned int WRITES_IN_FLIGHT = 16;
+
+	//Smallest number of heights worth giving a thread of its own when reducing a level
+	static const unsigned int HEIGHTS_PER_THREAD = 65536;
+
+	//A level is either the heightmap or a level reduced from it, which is one row after the other
+	struct Level {
+		const TiledHeightMap* heightMap;
+		const float* heights;
+		unsigned int dimension;
+	};
+
+	//Copy part of a row of a level
+	static void getRow(const Level& level, unsigned int row, unsigned int firstColumn, unsigned int count, float* heights) {
+
+		if (level.heightMap != NULL) {
+			level.heightMap->getRow(row, firstColumn, count, heights);
+		}
+		else {
+			std::memcpy(heights, level.heights + (size_t)row * level.dimension + firstColumn, count * sizeof(float));
+		}
+	}
+
+	//Reduce a band of rows of the next level from a level. Every height of the next level is the tent filtered 3x3 block of
+	//heights around the same point of the level, with the heights past the edges taken from the edges.
+	static void reduceRows(Level source, float* destination, unsigned int firstRow, unsigned int lastRow) {
+
+		unsigned int sourceDimension = source.dimension, destinationDimension = (sourceDimension - 1) / 2 + 1;
+		std::vector<float> above(sourceDimension), center(sourceDimension), below(sourceDimension), columnSums(sourceDimension);
+
+		for (unsigned int row = firstRow; row <= lastRow; ++row) {
+
+			getRow(source, row > 0 ? 2 * row - 1 : 0, 0, sourceDimension, above.data());
+			getRow(source, 2 * row, 0, sourceDimension, center.data());
+			getRow(source, std::min(2 * row + 1, sourceDimension - 1), 0, sourceDimension, below.data());
+
+			//Filter down the columns first
+			unsigned int column = 0;
+#ifdef TERRAIN_USE_SSE
+			__m128 twos = _mm_set1_ps(2.0);
+			for (; column + 4 <= sourceDimension; column += 4) {
+				__m128 sums = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(&above[column]), _mm_mul_ps(_mm_loadu_ps(&center[column]), twos)), _mm_loadu_ps(&below[column]));
+				_mm_storeu_ps(&columnSums[column], sums);
+			}
+#endif
+			for (; column < sourceDimension; ++column) {
+				columnSums[column] = above[column] + center[column] * 2.0f + below[column];
+			}
+
+			//Then across the row, where the left and right neighbors of four even columns are the odd columns around them
+			const float* sums = columnSums.data();
+			float* heights = destination + (size_t)row * destinationDimension;
+			heights[0] = (sums[0] + sums[0] * 2.0f + sums[std::min(1u, sourceDimension - 1)]) * 0.0625f;
+			column = 1;
+#ifdef TERRAIN_USE_SSE
+			__m128 sixteenths = _mm_set1_ps(0.0625);
+			for (; 2 * column + 8 <= sourceDimension; column += 4) {
+				__m128 lefts = _mm_shuffle_ps(_mm_loadu_ps(sums + 2 * column - 1), _mm_loadu_ps(sums + 2 * column + 3), _MM_SHUFFLE(2, 0, 2, 0));
+				__m128 evens = _mm_loadu_ps(sums + 2 * column), odds = _mm_loadu_ps(sums + 2 * column + 4);
+				__m128 centers = _mm_shuffle_ps(evens, odds, _MM_SHUFFLE(2, 0, 2, 0)), rights = _mm_shuffle_ps(evens, odds, _MM_SHUFFLE(3, 1, 3, 1));
+				_mm_storeu_ps(heights + column, _mm_mul_ps(_mm_add_ps(_mm_add_ps(lefts, _mm_mul_ps(centers, twos)), rights), sixteenths));
+			}
+#endif
+			for (; column < destinationDimension; ++column) {
+				heights[column] = (sums[2 * column - 1] + sums[2 * column] * 2.0f + sums[std::min(2 * column + 1, sourceDimension - 1)]) * 0.0625f;
+			}
+		}
+	}
+
+	//Reduce the next level from a level, splitting its rows into bands reduced on the given number of threads, or one for every core
+	static void reduce(const Level& source, std::vector<float>& destination, unsigned int threadCount) {
+
+		unsigned int destinationDimension = (source.dimension - 1) / 2 + 1;
+		destination.resize((size_t)destinationDimension * destinationDimension);
+
+		if (threadCount == 0) {
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		threadCount = (unsigned int)std::max(std::min((size_t)threadCount, destination.size() / HEIGHTS_PER_THREAD), (size_t)1);
+		unsigned int bandRows = (destinationDimension + threadCount - 1) / threadCount;
+
+		//This thread reduces the first band
+		std::vector<std::thread> threads;
+		for (unsigned int bandFirstRow = bandRows; bandFirstRow < destinationDimension; bandFirstRow += bandRows) {
+			threads.push_back(std::thread(reduceRows, source, destination.data(), bandFirstRow, std::min(bandFirstRow + bandRows, destinationDimension) - 1));
+		}
+		reduceRows(source, destination.data(), 0, std::min(bandRows, destinationDimension) - 1);
+		for (unsigned int threadCounter = 0; threadCounter < threads.size(); ++threadCounter) {
+			threads[threadCounter].join();
+		}
+	}
+
+	static void makeDirectory(const std::string& directory) {
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+	}
+
+	//Cut out and write one row of tiles of a level
+	static void writeTileRow(const Level& level, unsigned int zoom, unsigned int tileRow, unsigned int tileCells, const std::string& directory,
+		std::atomic<bool>& failed) {
+
+		AsyncFileWriter writer(WRITES_IN_FLIGHT);
+		unsigned int tileDimension = tileCells + 1, tileCount = (level.dimension - 1) / tileCells;
+		for (unsigned int tileColumn = 0; tileColumn < tileCount; ++tileColumn) {
+
+			std::shared_ptr<std::vector<unsigned char> > tile(new std::vector<unsigned char>((size_t)tileDimension * tileDimension * sizeof(float)));
+			for (unsigned int row = 0; row < tileDimension; ++row) {
+				getRow(level, tileRow * tileCells + row, tileColumn * tileCells, tileDimension, (float*)tile->data() + (size_t)row * tileDimension);
+			}
+
+			std::stringstream fileName;
+			fileName << directory << "/" << zoom << "/" << tileColumn << "/" << tileRow << ".raw";
+			writer.write(fileName.str(), tile);
+		}
+		if (!writer.finish()) {
+			failed = true;
+		}
+	}
+
+public:
+
+	//Get the number of heights on each side of a tile of a heightmap
+	static unsigned int getTileDimension(unsigned int dimension) {
+		return std::min(TILE_CELLS, dimension - 1) + 1;
+	}
+
+	//Get the finest zoom level of a heightmap, at which it is 2^zoom tiles across
+	static unsigned int getMaxZoom(unsigned int dimension) {
+
+		unsigned int zoom = 0;
+		while (((dimension - 1) >> zoom) > TILE_CELLS) {
+			++zoom;
+		}
+		return zoom;
+	}
+
+	//Export the pyramid of a 2^n+1 heightmap to a directory, which is made if it does not exist. The levels are reduced and the
+	//tiles written on the given number of threads, or one for every core. Returns false if any tile could not be written.
+	static bool exportPyramid(const TiledHeightMap& heightMap, const std::string& directory, unsigned int threadCount = 0) {
+
+		unsigned int dimension = heightMap.getDimension(), maxZoom = getMaxZoom(dimension), tileCells = getTileDimension(dimension) - 1;
+
+		//Every level but the finest one is reduced before any tile is written
+		std::vector<std::vector<float> > reducedLevels(maxZoom);
+		std::vector<Level> levels(maxZoom + 1);
+		levels[maxZoom].heightMap = &heightMap;
+		levels[maxZoom].heights = NULL;
+		levels[maxZoom].dimension = dimension;
+		for (unsigned int zoom = maxZoom; zoom > 0; --zoom) {
+			reduce(levels[zoom], reducedLevels[zoom - 1], threadCount);
+			levels[zoom - 1].heightMap = NULL;
+			levels[zoom - 1].heights = reducedLevels[zoom - 1].data();
+			levels[zoom - 1].dimension = (levels[zoom].dimension - 1) / 2 + 1;
+		}
+
+		makeDirectory(directory);
+		for (unsigned int zoom = 0; zoom <= maxZoom; ++zoom) {
+			std::stringstream zoomDirectory;
+			zoomDirectory << directory << "/" << zoom;
+			makeDirectory(zoomDirectory.str());
+			for (unsigned int tileColumn = 0; tileColumn < (1u << zoom); ++tileColumn) {
+				std::stringstream columnDirectory;
+				columnDirectory << zoomDirectory.str() << "/" << tileColumn;
+				makeDirectory(columnDirectory.str());
+			}
+		}
+
+		//The pool finishes every job before it is destroyed. The finest level has the most tiles, so it goes first.
+		std::atomic<bool> failed(false);
+		{
+			ThreadPool threadPool(threadCount);
+			for (int zoom = maxZoom; zoom >= 0; --zoom) {
+				for (unsigned int tileRow = 0; tileRow < (1u << zoom); ++tileRow) {
+					const Level* level = &levels[zoom];
+					threadPool.submit([=, &directory, &failed] { writeTileRow(*level, zoom, tileRow, tileCells, directory, failed); });
+				}
+			}
+			threadPool.wait();
+		}
+		return !failed;
+	}
+
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "MappedFile.hpp"
+
+//Square block of TILE_DIMENSION x TILE_DIMENSION heights, given by its tile row and tile column
+struct TerrainTile {
+	unsigned int row, column;
+};
+
+//This class stores a square heightmap in square tiles. Copies of a heightmap share their tiles, and a shared tile is copied
+//only when one of the heightmaps writes to it. So a copy costs just the tile pointers, and a snapshot kept for undo or for
+//comparing versions of a terrain only holds the tiles that differ from the current heights. The heightmap is also sparse:
+//a tile is only allocated when a height in it is first set to something other than zero, and until then it reads as zero.
+//A heightmap loaded from a file reads its tiles in place in the mapped file, and a tile is copied out only when it is written.
+class TiledHeightMap {
+
+public:
+
+	//Number of heightmap rows and columns in a tile
+	static const unsigned int TILE_DIMENSION = 64;
+
+private:
+
+	unsigned int dimension, tilesPerSide;
+
+	//Tiles one row of tiles after the other. Each tile holds its heights one row after the other. Tiles on the right and
+	//bottom edges are only partly used. Tiles that have never been written are empty pointers, and the table itself is only
+	//made when the first tile is written, so a heightmap that is never written costs nothing however large it is.
+	std::vector<std::shared_ptr<std::vector<float>>> tiles;
+
+	//Tile of zeros read in place of the tiles that have not been allocated
+	std::shared_ptr<std::vector<float>> zeroTile;
+
+	//Tiles in the mapped file the heights were loaded from, for the tiles not written since. Empty if the heights were not
+	//loaded from a file. The file stays mapped as long as a copy of the heightmap may read from it.
+	std::vector<const float*> fileTiles;
+	std::shared_ptr<MappedFile> file;
+
+	//Get a tile that has been allocated, or NULL if it has not
+	const std::vector<float>* getAllocatedTile(size_t tile) const {
+		return tile < this->tiles.size() ? this->tiles[tile].get() : NULL;
+	}
+
+	//Get a tile in the mapped file, or NULL if the tile is not read from the file
+	const float* getFileTile(size_t tile) const {
+		return this->fileTiles.empty() ? NULL : this->fileTiles[tile];
+	}
+
+public:
+
+	//Constructor for an empty heightmap
+	TiledHeightMap() {
+		this->dimension = 0;
+		this->tilesPerSide = 0;
+	}
+
+	//Constructor for a heightmap of the given dimension with all heights zero. No tiles are allocated yet.
+	TiledHeightMap(unsigned int dimension) {
+
+		this->dimension = dimension;
+		this->tilesPerSide = (dimension + TILE_DIMENSION - 1) / TILE_DIMENSION;
+		this->zeroTile = std::make_shared<std::vector<float>>(TILE_DIMENSION * TILE_DIMENSION, 0.0f);
+	}
+
+	//Constructor for a heightmap read from a mapped file. There is a pointer for every tile, one row of tiles after the other,
+	//to its heights in the file, or NULL for a tile of zeros.
+	TiledHeightMap(unsigned int dimension, const std::shared_ptr<MappedFile>& file, const std::vector<const float*>& fileTiles) : TiledHeightMap(dimension) {
+		this->file = file;
+		this->fileTiles = fileTiles;
+	}
+
+	unsigned int getDimension() const {
+		return this->dimension;
+	}
+
+	unsigned int getTilesPerSide() const {
+		return this->tilesPerSide;
+	}
+
+	//Check if a tile has been allocated or is read from a file
+	bool isAllocatedTile(unsigned int tileRow, unsigned int tileColumn) const {
+		size_t tile = (size_t)tileRow * this->tilesPerSide + tileColumn;
+		return getAllocatedTile(tile) != NULL || getFileTile(tile) != NULL;
+	}
+
+	//Get the number of tiles that have been allocated or are read from a file
+	unsigned int getAllocatedTileCount() const {
+
+		unsigned int allocatedTiles = 0;
+		for (size_t tile = 0; tile < (size_t)this->tilesPerSide * this->tilesPerSide; ++tile) {
+			if (getAllocatedTile(tile) != NULL || getFileTile(tile) != NULL) {
+				++allocatedTiles;
+			}
+		}
+		return allocatedTiles;
+	}
+
+	//Get the heights of a tile for reading
+	const float* getTile(unsigned int tileRow, unsigned int tileColumn) const {
+		size_t tileIndex = (size_t)tileRow * this->tilesPerSide + tileColumn;
+		const std::vector<float>* tile = getAllocatedTile(tileIndex);
+		const float* fileTile = getFileTile(tileIndex);
+		return tile != NULL ? tile->data() : fileTile != NULL ? fileTile : this->zeroTile->data();
+	}
+
+	//Get the heights of a tile for writing. A tile that has not been allocated is allocated, a tile read from a file is copied
+	//out of the file, and a tile shared with another heightmap is copied first.
+	float* getWritableTile(unsigned int tileRow, unsigned int tileColumn) {
+
+		if (this->tiles.empty()) {
+			this->tiles.resize((size_t)this->tilesPerSide * this->tilesPerSide);
+		}
+		size_t tileIndex = (size_t)tileRow * this->tilesPerSide + tileColumn;
+		std::shared_ptr<std::vector<float>>& tile = this->tiles[tileIndex];
+		const float* fileTile = getFileTile(tileIndex);
+		if (!tile && fileTile != NULL) {
+			tile = std::make_shared<std::vector<float>>(fileTile, fileTile + TILE_DIMENSION * TILE_DIMENSION);
+			this->fileTiles[tileIndex] = NULL;
+		}
+		else if (!tile) {
+			tile = std::make_shared<std::vector<float>>(TILE_DIMENSION * TILE_DIMENSION, 0.0f);
+		}
+		else if (tile.use_count() != 1) {
+			tile = std::make_shared<std::vector<float>>(*tile);
+		}
+		else {
+			//A snapshot on another thread may just have let go of the tile, so its reads must be done before the tile is written
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+		return tile->data();
+	}
+
+	//Check if a tile is the same one in both heightmaps, which means that none of its heights differ
+	bool isSharedTile(const TiledHeightMap& other, unsigned int tileRow, unsigned int tileColumn) const {
+		size_t tile = (size_t)tileRow * this->tilesPerSide + tileColumn;
+		return getAllocatedTile(tile) == other.getAllocatedTile(tile) && getFileTile(tile) == other.getFileTile(tile);
+	}
+
+	float get(unsigned int row, unsigned int column) const {
+		return getTile(row / TILE_DIMENSION, column / TILE_DIMENSION)[(row % TILE_DIMENSION) * TILE_DIMENSION + column % TILE_DIMENSION];
+	}
+
+	void set(unsigned int row, unsigned int column, float height) {
+
+		//Setting a zero in a tile that has not been allocated changes nothing
+		if (height == 0.0 && !isAllocatedTile(row / TILE_DIMENSION, column / TILE_DIMENSION)) {
+			return;
+		}
+		getWritableTile(row / TILE_DIMENSION, column / TILE_DIMENSION)[(row % TILE_DIMENSION) * TILE_DIMENSION + column % TILE_DIMENSION] = height;
+	}
+
+	//Copy a run of heights from a row, which may cross tiles
+	void getRow(unsigned int row, unsigned int firstColumn, unsigned int count, float* heights) const {
+
+		unsigned int tileRow = row / TILE_DIMENSION, rowInTile = row % TILE_DIMENSION;
+		for (unsigned int column = firstColumn; column < firstColumn + count;) {
+			unsigned int columnInTile = column % TILE_DIMENSION, runLength = std::min(TILE_DIMENSION - columnInTile, firstColumn + count - column);
+			const float* tileRowStart = getTile(tileRow, column / TILE_DIMENSION) + rowInTile * TILE_DIMENSION;
+			std::copy(tileRowStart + columnInTile, tileRowStart + columnInTile + runLength, heights + column - firstColumn);
+			column += runLength;
+		}
+	}
+
+	//Copy all the heights into one array, one row after the other. Tiles that have not been allocated come out as zeros.
+	void toVector(std::vector<float>& heightMap) const {
+
+		heightMap.resize((size_t)this->dimension * this->dimension);
+		for (unsigned int row = 0; row < this->dimension; ++row) {
+			getRow(row, 0, this->dimension, &heightMap[(size_t)row * this->dimension]);
+		}
+	}
+
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//This class reorders the triangles of an index buffer so that vertices are reused while they are still in the GPU post-transform
+//vertex cache. It uses Tom Forsyth's linear-speed vertex cache optimization: every vertex gets a score from its position in a
+//simulated cache and from how many of its triangles are left, and the triangle with the best score is always added next.
+class VertexCacheOptimizer {
+
+private:
+
+	//Size of the simulated cache used for scoring
+	static const int CACHE_SIZE = 32;
+
+	//Size of the FIFO cache used to measure the average cache miss ratio
+	static const unsigned int FIFO_CACHE_SIZE = 16;
+
+	//FIFO cache that counts the vertices transformed for a stream of indices
+	class FifoCache {
+
+	private:
+
+		//Time at which each vertex was put into the cache
+		std::vector<unsigned int> cacheTimes;
+		unsigned int cacheTime, misses;
+
+	public:
+
+		FifoCache(unsigned int vertexCount) : cacheTimes(vertexCount, 0) {
+			this->cacheTime = FIFO_CACHE_SIZE + 1;
+			this->misses = 0;
+		}
+
+		void addVertex(unsigned int vertex) {
+			unsigned int& vertexTime = this->cacheTimes[vertex];
+			if (vertexTime == 0 || this->cacheTime - vertexTime > FIFO_CACHE_SIZE) {
+				vertexTime = this->cacheTime++;
+				++this->misses;
+			}
+		}
+
+		unsigned int getMisses() {
+			return this->misses;
+		}
+
+	};
+
+	//Score of a vertex from its position in the cache and the number of triangles that still use it
+	static float getVertexScore(int cachePosition, unsigned int remainingTriangles) {
+
+		if (remainingTriangles == 0) {
+			return -1.0;
+		}
+
+		float score = 0.0;
+		if (cachePosition >= 0) {
+			//The vertices of the last triangle get a fixed score so that the next triangle does not simply reuse all three
+			if (cachePosition < 3) {
+				score = 0.75;
+			}
+			else {
+				score = std::pow(1.0 - (cachePosition - 3) / (float)(CACHE_SIZE - 3), 1.5);
+			}
+		}
+
+		//Boost vertices with few triangles left so that they are finished off
+		return score + 2.0 / std::sqrt((float)remainingTriangles);
+	}
+
+public:
+
+	//Get the average cache miss ratio (ACMR), the number of vertices transformed per triangle, with a FIFO cache
+	static float getAcmr(const int* indices, unsigned int indexCount, unsigned int vertexCount) {
+
+		if (indexCount == 0) {
+			return 0.0;
+		}
+
+		FifoCache fifoCache(vertexCount);
+		for (unsigned int indexCounter = 0; indexCounter < indexCount; ++indexCounter) {
+			fifoCache.addVertex(indices[indexCounter]);
+		}
+		return fifoCache.getMisses() / (indexCount / 3.0f);
+	}
+
+	//Write the triangles in the optimized order. The optimized indices are only written, one after the other, so they can go
+	//straight into a mapped GPU buffer. They must not overlap the input indices. Returns the ACMR of the optimized order.
+	static float optimize(const int* indices, unsigned int indexCount, unsigned int vertexCount, int* optimizedIndices) {
+
+		unsigned int triangleCount = indexCount / 3;
+		if (triangleCount == 0) {
+			return 0.0;
+		}
+
+		//List the triangles of every vertex
+		std::vector<unsigned int> remainingTriangles(vertexCount, 0), firstTriangle(vertexCount + 1, 0);
+		for (unsigned int indexCounter = 0; indexCounter < indexCount; ++indexCounter) {
+			++remainingTriangles[indices[indexCounter]];
+		}
+		for (unsigned int vertex = 0; vertex < vertexCount; ++vertex) {
+			firstTriangle[vertex + 1] = firstTriangle[vertex] + remainingTriangles[vertex];
+		}
+		std::vector<unsigned int> vertexTriangles(indexCount), filledTriangles(vertexCount, 0);
+		for (unsigned int triangle = 0; triangle < triangleCount; ++triangle) {
+			for (unsigned int corner = 0; corner < 3; ++corner) {
+				unsigned int vertex = indices[3 * triangle + corner];
+				vertexTriangles[firstTriangle[vertex] + filledTriangles[vertex]++] = triangle;
+			}
+		}
+
+		//Score every vertex and triangle
+		std::vector<int> cachePositions(vertexCount, -1);
+		std::vector<float> vertexScores(vertexCount), triangleScores(triangleCount, 0.0);
+		std::vector<bool> triangleAdded(triangleCount, false);
+		for (unsigned int vertex = 0; vertex < vertexCount; ++vertex) {
+			vertexScores[vertex] = getVertexScore(-1, remainingTriangles[vertex]);
+		}
+		for (unsigned int triangle = 0; triangle < triangleCount; ++triangle) {
+			for (unsigned int corner = 0; corner < 3; ++corner) {
+				triangleScores[triangle] += vertexScores[indices[3 * triangle + corner]];
+			}
+		}
+
+		FifoCache fifoCache(vertexCount);
+		std::vector<unsigned int> cache, newCache;
+		unsigned int nextUnaddedTriangle = 0;
+		int bestTriangle = -1;
+
+		for (unsigned int addedCount = 0; addedCount < triangleCount; ++addedCount) {
+
+			//If no triangle around the cache is left then carry on with the next triangle in the original order
+			if (bestTriangle < 0) {
+				while (triangleAdded[nextUnaddedTriangle]) {
+					++nextUnaddedTriangle;
+				}
+				bestTriangle = nextUnaddedTriangle;
+			}
+
+			//Add the triangle and put its vertices at the front of the cache
+			triangleAdded[bestTriangle] = true;
+			newCache.clear();
+			for (unsigned int corner = 0; corner < 3; ++corner) {
+				unsigned int vertex = indices[3 * bestTriangle + corner];
+				*optimizedIndices++ = vertex;
+				fifoCache.addVertex(vertex);
+				newCache.push_back(vertex);
+
+				//Take the triangle off the vertex's list of remaining triangles
+				unsigned int* triangles = &vertexTriangles[firstTriangle[vertex]];
+				unsigned int* lastTriangle = triangles + remainingTriangles[vertex] - 1;
+				std::iter_swap(std::find(triangles, lastTriangle + 1, (unsigned int)bestTriangle), lastTriangle);
+				--remainingTriangles[vertex];
+			}
+			for (unsigned int cacheCounter = 0; cacheCounter < cache.size(); ++cacheCounter) {
+				if (std::find(newCache.begin(), newCache.begin() + 3, cache[cacheCounter]) == newCache.begin() + 3) {
+					newCache.push_back(cache[cacheCounter]);
+				}
+			}
+			cache.swap(newCache);
+
+			//Rescore the vertices in the cache and their triangles, including the ones that just dropped out of it
+			for (unsigned int cacheCounter = 0; cacheCounter < cache.size(); ++cacheCounter) {
+				unsigned int vertex = cache[cacheCounter];
+				cachePositions[vertex] = cacheCounter < (unsigned int)CACHE_SIZE ? cacheCounter : -1;
+				float scoreChange = getVertexScore(cachePositions[vertex], remainingTriangles[vertex]) - vertexScores[vertex];
+				vertexScores[vertex] += scoreChange;
+				for (unsigned int triangleCounter = 0; triangleCounter < remainingTriangles[vertex]; ++triangleCounter) {
+					triangleScores[vertexTriangles[firstTriangle[vertex] + triangleCounter]] += scoreChange;
+				}
+			}
+			if (cache.size() > (unsigned int)CACHE_SIZE) {
+				cache.resize(CACHE_SIZE);
+			}
+
+			//The next triangle is the best one using a vertex in the cache
+			bestTriangle = -1;
+			float bestScore = -1.0;
+			for (unsigned int cacheCounter = 0; cacheCounter < cache.size(); ++cacheCounter) {
+				unsigned int vertex = cache[cacheCounter];
+				for (unsigned int triangleCounter = 0; triangleCounter < remainingTriangles[vertex]; ++triangleCounter) {
+					unsigned int triangle = vertexTriangles[firstTriangle[vertex] + triangleCounter];
+					if (triangleScores[triangle] > bestScore) {
+						bestScore = triangleScores[triangle];
+						bestTriangle = triangle;
+					}
+				}
+			}
+		}
+
+		return fifoCache.getMisses() / (float)triangleCount;
+	}
+
+};
@@ -0,0 +1,53 @@
+#version 150
+
+in vec2 gPosition;
+
+out vec2 tex;
+out vec3 fN;
+out vec3 fE;
+out vec3 fL;
+
+uniform mat4 model_view_projection;
+uniform vec3 sunDirection;
+
+uniform sampler2D heights;
+uniform float dimension;
+uniform vec3 node;
+uniform vec2 morph;
+uniform vec3 eye;
+
+// Height of the terrain at a heightmap column and row
+float
+heightAt( vec2 cell )
+{
+    return texture( heights, (cell + 0.5) / dimension ).r;
+}
+
+// Model coordinates of the terrain at a heightmap column and row
+vec4
+positionAt( vec2 cell )
+{
+    return vec4( -1.0 + cell.x * 2.0 / dimension, heightAt( cell ), -1.0 + cell.y * 2.0 / dimension, 1.0 );
+}
+
+void
+main()
+{
+    // Morph the odd grid vertices onto the coarser grid as the vertex gets further from the eye
+    float morphK = clamp( (distance( positionAt( node.xy + gPosition * node.z ).xyz, eye ) - morph.x) / (morph.y - morph.x), 0.0, 1.0 );
+    vec2 cell = node.xy + (gPosition - fract( gPosition * 0.5 ) * 2.0 * morphK) * node.z;
+    vec4 position = positionAt( cell );
+
+    // Normal from the heights of the neighbors on this level's grid
+    float left = heightAt( cell - vec2( node.z, 0.0 ) );
+    float right = heightAt( cell + vec2( node.z, 0.0 ) );
+    float up = heightAt( cell - vec2( 0.0, node.z ) );
+    float down = heightAt( cell + vec2( 0.0, node.z ) );
+
+    gl_Position = model_view_projection * position;
+    tex = vec2( (position.x - 0.75 * position.z + 1.5) / 3.0, (position.y - 0.75 * position.z + 1.5) / 3.0 );
+
+    fN = vec3( left - right, 4.0 * node.z / dimension, up - down );
+    fE = position.xyz;
+    fL = sunDirection;
+}
@@ -11,11 +11,26 @@ uniform sampler2D texture;
 uniform vec4 AmbientProduct, DiffuseProduct, SpecularProduct;
 uniform float Shininess;
 
+// Normals baked from the full heightmap, one texel per height
+uniform sampler2D normals;
+uniform float dimension;
+uniform bool useNormalMap;
+
+// Ambient light left after occlusion in red and sunlight left after shadowing in green
+uniform sampler2D lightmap;
+uniform bool useLightmap;
+
 
 void main()
 {
     // Normalize the input lighting vectors
     vec3 N = normalize(fN);
+
+    // The model x and z of the fragment give the heightmap column and row
+    vec2 cell = (fE.xz + 1.0) * 0.5 + 0.5 / dimension;
+    if( useNormalMap ) {
+        N = normalize(texture2D(normals, cell).xyz * 2.0 - 1.0);
+    }
     vec3 E = normalize(fE);
     vec3 L = normalize(fL);
 
@@ -34,6 +49,7 @@ void main()
 	specular = vec4(0.0, 0.0, 0.0, 1.0);
     }
 
-    fColor = (ambient + diffuse + specular) * texture2D(texture, tex);
+    vec2 light = useLightmap ? texture2D(lightmap, cell).rg : vec2(1.0, 1.0);
+    fColor = (ambient * light.r + (diffuse + specular) * light.g) * texture2D(texture, tex);
     fColor.a = 1.0;
 }
@@ -1,10 +1,33 @@
 #define _CRT_SECURE_NO_DEPRECATE
 
 #include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include "Angel.h"
 #include "Terrain.hpp"
+#include "RtinMesher.hpp"
+#include "CdlodQuadtree.hpp"
+#include "VertexCacheOptimizer.hpp"
+#include "TerrainBuffers.hpp"
+#include "FrameTimer.hpp"
+#include "NormalMapBaker.hpp"
+#include "LightmapBaker.hpp"
+#include "TextureImage.hpp"
+#include "HeightMapFile.hpp"
+#include "MeshExporter.hpp"
+#include "TerrainCache.hpp"
+#ifdef _WIN32
+#include <GL/wglew.h>
+#elif !defined(__APPLE__)
+#include <GL/glx.h>
+#endif
 
 // The following line is apparently necessary to allow the glew
 // lib to link correctly for Visual Studios. You may need to 
@@ -13,118 +36,203 @@
 
 // Initialize the arrays for the vertices and triangles
 long nvertices, nindices;
-std::vector<vec3> vertices;
 std::vector<int> indices;
-std::vector<vec3> triangles;
-std::vector<vec3> normals;
 vec3 vertex;
 
+// Terrain being drawn, and the one being made in the background. The vertices of the new terrain are written straight into the
+// mapped buffers of the next buffer set.
+std::shared_ptr<Terrain> terrain, newTerrain;
+unsigned int meshDimension;
+std::vector<DirtyRegion> dirtyRegions;
+std::shared_ptr<TerrainBuffers> terrainBuffers;
+
 GLfloat Theta[3] = {20.0, 180.0, 0.0}; // Array of rotaion
-GLuint theta; // Location of "theta" shader uniform variable
 GLfloat ModelView[4] = {0.0, 0.0, 0.0, 0.0};
-GLuint model_view;
 GLfloat Zoom[4] = {1.0, 1.0, 1.0, 1.0};
-GLuint zoom;
+GLuint model_view_projection; // Location of the transform built from the rotation, translation, zoom and projection each frame
 
 // Texture objects and storage for texture image
-GLuint textures[2];
+GLuint textures[4];
 const int  TextureSize  = 64;
 GLubyte image[TextureSize][TextureSize][3];
-std::vector<vec2> tex_coords;
 
-char selectedTerrain, startLocation;
+char selectedTerrain, startLocation, selectedMesh;
+GLfloat meshMaxError = 0.0;
+
+// Chunked level of detail terrain. Every selected chunk is drawn with the same patch mesh.
+std::shared_ptr<CdlodQuadtree> chunkQuadtree, newChunkQuadtree;
+std::vector<CdlodSelection> selectedChunks;
+std::vector<vec2> patchVertices;
+const unsigned int ChunkPatchDimension = 32;
+ChunkCuller chunkCuller;
+GLuint node, morph, eye, dimension;
+
+// Normals baked from the full heightmap so that adaptive and chunked meshes are lit at full resolution. N switches between the
+// normal map and the vertex normals.
+std::vector<unsigned char> newNormalMap;
+GLuint useNormalMap;
+bool normalMapUsed = true;
+
+// Ambient occlusion and sun shadows baked from horizon angles. M switches the lightmap on and off.
+const vec3 SunDirection(0.0, 1.0, 2.0);
+std::vector<unsigned char> newLightmap;
+GLuint useLightmap;
+bool lightmapUsed = true;
+
+// Sculpted terrains are re-baked on their own worker from a snapshot of the heights, and the GL thread uploads the lightmap
+// between frames. A stroke that ends while a bake runs is baked once that bake is done.
+std::thread lightmapThread;
+std::atomic<bool> lightmapBaked(false);
+bool lightmapRebakeWanted = false;
+std::shared_ptr<Terrain> lightmapTerrain;
+std::vector<unsigned char> rebakedLightmap;
+
+// Terrains are generated and meshed on a worker thread while the current terrain is still drawn. The worker asks the GL thread
+// to map a buffer set, fills it, and the GL thread swaps it in between frames.
+enum RegenerationState { REGENERATION_IDLE, GENERATING, WAITING_FOR_BUFFERS, WRITING_BUFFERS, READY_TO_SWAP };
+std::atomic<int> regenerationState(REGENERATION_IDLE);
+std::thread regenerationThread;
+std::mutex regenerationMutex;
+std::condition_variable buffersMapped;
+TerrainBufferSet* regenerationBufferSet = NULL;
+std::chrono::steady_clock::time_point regenerationStart;
+const GLfloat EyeDepth = 2.0;
 int screenWidth = 640, screenHeight = 480;
 
-// Makes the triangles from the vertices and indices
-void make_triangles() 
+// Perspective projection. The field of view shows the whole unzoomed terrain at the eye depth.
+const GLfloat FieldOfView = 53.13, NearDistance = 0.05, FarDistance = 10.0;
+
+// Frames are only drawn when the view or the terrain changes. While a terrain is being made a timer checks on it instead.
+const unsigned int RegenerationPollInterval = 5;
+FrameTimer frameTimer;
+
+// Brush applied by dragging with the left mouse button. B switches between raising, lowering, smoothing and flattening.
+TerrainBrush sculptingBrush(TerrainBrush::RAISE, 8.0, 0.005);
+std::vector<TerrainTile> changedTiles;
+bool sculpting = false;
+
+// Did the current stroke change any heights. The lightmap is only baked again after strokes that did.
+bool strokeChangedHeights = false;
+
+// Heights before each sculpting stroke. Snapshots share the tiles that a stroke did not change, so each costs only what it changed.
+std::vector<TiledHeightMap> undoHistory;
+const unsigned int UndoHistoryLength = 32;
+
+// Heightmap file given on the command line. Its heights are read in place in the mapped file, and every terrain made from it
+// shares them until they are sculpted. S saves the terrain being drawn.
+std::string heightMapFileName;
+TiledHeightMap fileHeights;
+HeightMapInfo fileInfo;
+const char* const SavedHeightMapName = "terrain.thm";
+
+// E writes the full resolution mesh of the terrain being drawn for other tools
+const char* const ExportedMeshName = "terrain.glb";
+
+// Generated terrains are kept on disk by generator, dimension, constants and seed, so a terrain seen before is mapped rather than
+// generated again. G moves on to the next seed, so the same sequence of terrains comes back on every run.
+TerrainCache terrainCache("terrains");
+unsigned int terrainSeed = std::default_random_engine::default_seed;
+
+// Makes the vertex normal from the slope of the heightmap around the vertex. The heightmap is used rather than the triangles
+// so that every vertex can be written once, in order, into a mapped buffer, and so that adaptive meshes are lit like the full one.
+vec3 make_normal(unsigned int terrainDimension, const TiledHeightMap& heightMap, unsigned int row, unsigned int column)
 {
-	int vCount = 0;
-	for(unsigned int i = 0; i<indices.size(); i++){
-		triangles.push_back(vertices[indices[i]]);
-		//std::cout << "Storing vertex " << vertices[indices[i]].x << ", " << vertices[indices[i]].y << ", " << vertices[indices[i]].z << std::endl;
+	unsigned int left = column > 0 ? column - 1 : column, right = column < terrainDimension - 1 ? column + 1 : column;
+	unsigned int above = row > 0 ? row - 1 : row, below = row < terrainDimension - 1 ? row + 1 : row;
+	float stepValue = 2.0 / terrainDimension;
 
-		vCount++;
-		if(vCount == 3){
-			vec3 normal = normalize(cross(triangles[i-1]-triangles[i-2],
-							triangles[i]-triangles[i-1]));
-			
-			normals.push_back(normal);
-			normals.push_back(normal);
-			normals.push_back(normal);
-			vCount = 0;
-		}
-	}
+	float xSlope = (heightMap.get(row, right) - heightMap.get(row, left)) / ((right - left) * stepValue);
+	float zSlope = (heightMap.get(below, column) - heightMap.get(above, column)) / ((below - above) * stepValue);
+	return normalize(vec3(-xSlope, 1.0, -zSlope));
 }
 
 //Drape the texture on the terrain
-void make_texture()
+vec2 make_texture(const vec3& vertex)
 {
+	float xTextureCoordinate = (vertex.x - 0.75 * vertex.z + 1.5) / 3.0;
+	float yTextureCoordinate = (vertex.y - 0.75 * vertex.z + 1.5) / 3.0;
+	return vec2(xTextureCoordinate, yTextureCoordinate);
+}
 
-	float xVertexCoordinate = 0.0, yVertexCoordinate = 0.0, zVertexCoordinate = 0.0, xTextureCoordinate = 0.0, yTextureCoordinate = 0.0;
-	for(unsigned int i = 0; i<indices.size(); i++) {
-
-		xVertexCoordinate = vertices.at(indices.at(i)).x;
-		yVertexCoordinate = vertices.at(indices.at(i)).y;
-		zVertexCoordinate = vertices.at(indices.at(i)).z;
-
-		xTextureCoordinate = (xVertexCoordinate - 0.75 * zVertexCoordinate + 1.5) / 3.0;
-		yTextureCoordinate = (yVertexCoordinate - 0.75 * zVertexCoordinate + 1.5) / 3.0;
+//Write the vertices, texture coordinates and normals for a run of columns of a heightmap row. Every value is written once, in order,
+//which is the fast way to fill write-combined GPU memory.
+void writeVertexRow(unsigned int terrainDimension, const TiledHeightMap& heightMap, unsigned int row, unsigned int firstColumn, unsigned int lastColumn,
+	vec3* vertices, vec2* textureCoordinates, vec3* normals)
+{
+	//Find the step value for x and z coordinates based on a range of -1 to +1
+	float stepValue = 2.0 / terrainDimension;
 
-		tex_coords.push_back(vec2(xTextureCoordinate, yTextureCoordinate));
+	//The row and columns give the x and z coordinate steps. The value gives the height or y coordinate.
+	for (unsigned int column = firstColumn; column <= lastColumn; ++column) {
+		vec3 vertex(-1.0 + column * stepValue, heightMap.get(row, column), -1.0 + row * stepValue);
+		*vertices++ = vertex;
+		*textureCoordinates++ = make_texture(vertex);
+		*normals++ = make_normal(terrainDimension, heightMap, row, column);
+	}
+}
 
+//Write the vertices, texture coordinates and normals of the whole terrain into a mapped buffer set
+void writeVertices(unsigned int terrainDimension, const TiledHeightMap& heightMap, TerrainBufferSet& bufferSet)
+{
+	for (unsigned int row = 0; row < terrainDimension; ++row) {
+		unsigned int offset = row * terrainDimension;
+		writeVertexRow(terrainDimension, heightMap, row, 0, terrainDimension - 1, bufferSet.vertices + offset, bufferSet.textureCoordinates + offset, bufferSet.normals + offset);
 	}
 }
 
-//Read texture file into array
-unsigned char* readTextureFile(const char * filename, int width, int height){
-	unsigned char* data;
-	FILE* file;
+//Create the patch mesh used to draw every terrain chunk. The indices of each quadrant are kept together so that a quadrant can be drawn on its own.
+void createPatchIndicesAndVertices(unsigned int patchDimension) {
 
-	file = fopen(filename, "rb");
+	//Put a vertex at every grid position of the patch
+	for (unsigned int row = 0; row <= patchDimension; ++row) {
+		for (unsigned int column = 0; column <= patchDimension; ++column) {
+			patchVertices.push_back(vec2(column, row));
+		}
+	}
 
-	if (file == NULL){
-		return 0;
+	//Add two triangles for every cell of each quadrant
+	unsigned int quadrantDimension = patchDimension / 2, currentVertex, vertexBelow, afterVertexBelow, nextVertex;
+	for (unsigned int quadrant = 0; quadrant < 4; ++quadrant) {
+		unsigned int firstRow = (quadrant / 2) * quadrantDimension, firstColumn = (quadrant % 2) * quadrantDimension;
+		for (auto rowCounter = firstRow; rowCounter < firstRow + quadrantDimension; ++rowCounter) {
+			for (auto cellCounter = firstColumn; cellCounter < firstColumn + quadrantDimension; ++cellCounter) {
+				currentVertex = rowCounter * (patchDimension + 1) + cellCounter;
+				nextVertex = currentVertex + 1;
+				vertexBelow = currentVertex + patchDimension + 1;
+				afterVertexBelow = vertexBelow + 1;
+				indices.push_back(currentVertex);
+				indices.push_back(vertexBelow);
+				indices.push_back(afterVertexBelow);
+				indices.push_back(currentVertex);
+				indices.push_back(afterVertexBelow);
+				indices.push_back(nextVertex);
+			}
+		}
 	}
+}
 
-	data = (unsigned char *)malloc(width * height * 3);
-	fread(data, width * height * 3, 1, file);
-	fclose(file);
+//Create the triangle indices of the terrain and keep the terrain. The vertices are written when the mesh is uploaded.
+void createIndicesAndVertices(std::shared_ptr<Terrain> terrain) {
 
-	for (int i = 0; i < width * height; ++i){
-		int index = i * 3;
-		unsigned char B, R;
-		B = data[index];
-		R = data[index + 2];
+	newTerrain = terrain;
+	unsigned int terrainDimension = terrain->getTerrainDimension();
+	std::vector<float> heightMap = terrain->getTerrain();
 
-		data[index] = R;
-		data[index + 2] = B;
+	//The chunked level of detail terrain keeps the heightmap in a quadtree and draws it with one small patch mesh
+	if (selectedMesh == 'L') {
+		newChunkQuadtree = std::shared_ptr<CdlodQuadtree>(new CdlodQuadtree(terrainDimension, heightMap, terrain->getHeightPyramid(), ChunkPatchDimension));
+		return;
 	}
-	return data;
-}
 
-void createIndicesAndVertices(unsigned int terrainDimension, std::vector<float> heightMap) {
-	//Find the step value for x and z coordinates based on a range of -1 to +1
-	float stepValue = 2.0 / terrainDimension;
-
-	//Set the x and z coordinates to the beginning of the height map
-	GLfloat xCoordinate = -1.0, zCoordinate = -1.0;
+	meshDimension = terrainDimension;
 
-	//Loop through the height map and create vertices. The row and columns give the x and z coordinate steps. The value gives the height or y coordinate.
-	unsigned int numberOfVertices = terrainDimension * terrainDimension, row, column;
-	for (auto counter = 0; counter < numberOfVertices; ++counter) {
-		//Compute row and column from offset
-		row = counter / terrainDimension;
-		column = counter % terrainDimension;
-		//Reset coordinates when moving to next row
-		if (counter % terrainDimension == 0 && counter != 0) {
-			xCoordinate = -1.0;
-			zCoordinate += stepValue;
-		}
-		//Put vertex into vertex array
-		vertices.push_back(vec3(xCoordinate, heightMap.at(counter), zCoordinate));
-		//std::cout << "Storing vertex " << counter << " at height " << heightMap.at(counter) << " for x " << xCoordinate << " and z " << zCoordinate << std::endl;
-		//Move to the next element
-		xCoordinate += stepValue;
+	//Populate the indices from an adaptive mesh if a maximum mesh error was selected
+	if (meshMaxError > 0.0) {
+		RtinMesher rtinMesher(terrainDimension, heightMap);
+		rtinMesher.getIndices(meshMaxError, indices);
+		std::cout << "Adaptive mesh has " << indices.size() / 3 << " triangles instead of " << 
+			2 * (terrainDimension - 1) * (terrainDimension - 1) << std::endl;
+		return;
 	}
 
 	//Populate the indices from the constructed terrain
@@ -151,81 +259,96 @@ void createIndicesAndVertices(unsigned int terrainDimension, std::vector<float>
 
 }
 
-//Create terrain based on particle deposition
-void createParticleDepositionTerrain(char startLocation) {
+//Get a terrain from the cache, which generates it the first time it is asked for, and keep it to be meshed
+void createCachedTerrain(const std::string& typeName, unsigned int terrainDimension, char startLocation) {
 
-	unsigned int terrainDimension = 257;
-	//Construct the terrain
-	ParticleDepositionTerrain particleDepositionTerrain(terrainDimension, startLocation);
-	particleDepositionTerrain.makeTerrain();
+	bool cached;
+	std::shared_ptr<Terrain> cachedTerrain = terrainCache.get(typeName, terrainDimension, terrainSeed, startLocation, cached);
+	std::cout << (cached ? "Loaded terrain with seed " : "Generated terrain with seed ") << terrainSeed << (cached ? " from the cache" : "") << std::endl;
 
 	//Populate the vertices from the constructed terrain
-	std::vector<float> heightMap = particleDepositionTerrain.getTerrain();
+	createIndicesAndVertices(cachedTerrain);
+}
 
-	createIndicesAndVertices(terrainDimension, heightMap);
+//Create terrain based on particle deposition
+void createParticleDepositionTerrain(char startLocation) {
+	createCachedTerrain("deposition", 257, startLocation);
 }
 
 //Create terrain based on roll down particle deposition
 void createRollDownParticleDepositionTerrain(char startLocation) {
+	createCachedTerrain("rolldown", 257, startLocation);
+}
 
-	unsigned int terrainDimension = 257;
-	//Construct the terrain
-	RollDownParticleDepositionTerrain rollDownParticleDepositionTerrain(terrainDimension, startLocation);
-	rollDownParticleDepositionTerrain.makeTerrain();
+//Create terrain based on step faults
+void createStepFaultTerrain() {
+	createCachedTerrain("stepfault", 257, 'c');
+}
 
-	//Populate the vertices from the constructed terrain
-	std::vector<float> heightMap = rollDownParticleDepositionTerrain.getTerrain();
+//Create terrain based on cosine bumps in random locations
+void createCosineBumpTerrain() {
+	createCachedTerrain("bump", 513, 'c');
+}
 
-	createIndicesAndVertices(terrainDimension, heightMap);
+//Create square diamond terrain
+void createSquareDiamondTerrain() {
+	createCachedTerrain("squarediamond", 1025, 'c');
 }
 
-//Create terrain based on step faults
-void createStepFaultTerrain() {
+//Create a terrain from the heightmap file
+void createTerrainFromFile() {
+	createIndicesAndVertices(std::shared_ptr<Terrain>(new LoadedTerrain(fileHeights, fileInfo)));
+}
 
-	unsigned int terrainDimension = 257;
-	//Construct the terrain
-	StepFaultTerrain stepFaultTerrain(terrainDimension);
-	stepFaultTerrain.makeTerrain();
+//Create the selected type of terrain
+void createTerrain(char terrainType) {
 
-	//Populate the vertices from the constructed terrain
-	std::vector<float> heightMap = stepFaultTerrain.getTerrain();
+	switch (terrainType) {
 
-	createIndicesAndVertices(terrainDimension, heightMap);
+	case 'F':
+		createTerrainFromFile();
+		break;
 
-}
+	case '1':
+		createParticleDepositionTerrain(startLocation);
+		break;
 
-//Create terrain based on cosine bumps in random locations
-void createCosineBumpTerrain() {
+	case '2':
+		createRollDownParticleDepositionTerrain(startLocation);
+		break;
 
-	unsigned int terrainDimension = 513;
-	//Construct the terrain
-	BumpTerrain bumpTerrain(terrainDimension);
-	bumpTerrain.makeTerrain();
+	case '3':
+		createSquareDiamondTerrain();
+		break;
 
-	//Populate the vertices from the constructed terrain
-	std::vector<float> heightMap = bumpTerrain.getTerrain();
+	case '4':
+		createStepFaultTerrain();
+		break;
 
-	createIndicesAndVertices(terrainDimension, heightMap);
+	case '7':
+		createCosineBumpTerrain();
+		break;
 
+	}
 }
 
-//Create square diamond terrain
-void createSquareDiamondTerrain() {
-
-	unsigned int terrainDimension = 1025;
-	//Construct the terrain
-	SquareDiamondTerrain squareDiamondTerrain(terrainDimension);
-	squareDiamondTerrain.makeTerrain();
+//Write the triangles in an order that reuses vertices from the GPU post-transform cache. The quadrants of the chunk patch are
+//reordered separately so that each can still be drawn on its own.
+void optimizeVertexCache(int* optimizedIndices) {
 
-	//Populate the vertices from the constructed terrain
-	std::vector<float> heightMap = squareDiamondTerrain.getTerrain();
+	unsigned int vertexCount = selectedMesh == 'L' ? patchVertices.size() : meshDimension * meshDimension;
+	unsigned int rangeCount = selectedMesh == 'L' ? 4 : 1, rangeSize = indices.size() / rangeCount;
 
-	createIndicesAndVertices(terrainDimension, heightMap);
+	float acmrBefore = VertexCacheOptimizer::getAcmr(indices.data(), indices.size(), vertexCount), acmrAfter = 0.0;
+	for (unsigned int range = 0; range < rangeCount; ++range) {
+		acmrAfter += VertexCacheOptimizer::optimize(indices.data() + range * rangeSize, rangeSize, vertexCount, optimizedIndices + range * rangeSize) / rangeCount;
+	}
 
+	std::cout << "Vertices transformed per triangle (ACMR) went from " << acmrBefore << " to " << acmrAfter << std::endl;
 }
 
-//Get user selection
-void getUserSelection() {
+//Get the type of terrain to generate from the user
+void getTerrainSelection() {
 
 	std::cout << "Select the type of terrain:" << std::endl;
 	std::cout << "1 = Sticky Particle Deposition" << std::endl;
@@ -271,114 +394,391 @@ void getUserSelection() {
 			}
 		}
 	}
+}
+
+//Get user selection
+void getUserSelection() {
+
+	//A heightmap file takes the place of the type of terrain
+	if (!heightMapFileName.empty()) {
+		if (!HeightMapFile::load(heightMapFileName, fileHeights, fileInfo)) {
+			std::cout << "Cannot read the heightmap file " << heightMapFileName << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		std::cout << "Opened " << heightMapFileName << ", a " << fileHeights.getDimension() << " x " << fileHeights.getDimension() <<
+			" heightmap" << (fileInfo.generatorName.empty() ? "" : " made by " + fileInfo.generatorName) << std::endl;
+		selectedTerrain = 'F';
+	}
+	else {
+		getTerrainSelection();
+	}
+
+	//Get the mesh type. Adaptive meshes draw flat areas with fewer triangles and chunked meshes draw distant areas with fewer triangles.
+	std::cout << std::endl << "Select the terrain mesh:" << std::endl;
+	std::cout << "F = Full resolution" << std::endl;
+	std::cout << "A = Adaptive" << std::endl;
+	std::cout << "L = Chunked level of detail" << std::endl << std::endl;
+	bool validSelection = false;
+	while (!validSelection) {
+		std::cin >> selectedMesh;
+		selectedMesh = toupper(selectedMesh);
+		if (selectedMesh != 'F' && selectedMesh != 'A' && selectedMesh != 'L') {
+			std::cout << "Incorrect selection. Please try again" << std::endl;
+		}
+		else {
+			validSelection = true;
+			break;
+		}
+	}
+
+	//Get the maximum mesh error for adaptive meshes
+	if (selectedMesh == 'A') {
+		std::cout << std::endl << "Enter the maximum mesh error (for example 0.002):" << std::endl << std::endl;
+		while (!(std::cin >> meshMaxError) || meshMaxError < 0.0) {
+			std::cout << "Incorrect selection. Please try again" << std::endl;
+			std::cin.clear();
+			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		}
+	}
 
+	std::cout << std::endl << "Press G in the terrain window for a new terrain, or 1 to 4 or 7 to change the type of terrain" << std::endl;
+	std::cout << "Drag with the left mouse button to sculpt the terrain, press B to change what the brush does and Ctrl+Z to undo" << std::endl;
+	std::cout << "Press N to switch between the baked normal map and the vertex normals, and M to switch ambient occlusion and shadows on and off" << std::endl;
+	std::cout << "Press T to show the recent frame times, and S to save the heightmap to " << SavedHeightMapName << std::endl;
+	std::cout << "Press E to export the full resolution mesh to " << ExportedMeshName << std::endl;
 }
 
-// Init Function
-void init(void)
+//Generate and mesh a terrain on the worker thread. The vertices and the reordered indices are written straight into a mapped
+//buffer set, so only the heightmap and the raw indices are held on the CPU, and only until the new terrain is swapped in.
+void regenerateTerrain(char terrainType)
 {
-	getUserSelection();
+	createTerrain(terrainType);
+	NormalMapBaker::bake(newTerrain->getHeightMap(), newNormalMap);
+	LightmapBaker::bake(newTerrain->getHeightMap(), SunDirection.x, SunDirection.y, SunDirection.z, newLightmap);
+
+	if (selectedMesh != 'L') {
+		//Wait for the GL thread to map a buffer set that is not being drawn
+		{
+			std::unique_lock<std::mutex> lock(regenerationMutex);
+			regenerationState = WAITING_FOR_BUFFERS;
+			buffersMapped.wait(lock, [] { return regenerationState == WRITING_BUFFERS; });
+		}
+		writeVertices(meshDimension, newTerrain->getHeightMap(), *regenerationBufferSet);
+		optimizeVertexCache(regenerationBufferSet->indices);
+	}
 
-	switch (selectedTerrain) {
+	regenerationState = READY_TO_SWAP;
+}
 
-	case '1':
-		createParticleDepositionTerrain(startLocation);
-		break;
+void pollRegeneration(int value);
 
-	case '2':
-		createRollDownParticleDepositionTerrain(startLocation);
-		break;
+//Start making a new terrain in the background. Returns false if one is already being made.
+bool startRegeneration(char terrainType)
+{
+	if (regenerationState != REGENERATION_IDLE) {
+		return false;
+	}
 
-	case '3':
-		createSquareDiamondTerrain();
-		break;
+	std::cout << "Generating terrain in the background" << std::endl;
+	regenerationStart = std::chrono::steady_clock::now();
+	regenerationState = GENERATING;
+	regenerationThread = std::thread(regenerateTerrain, terrainType);
+	glutTimerFunc(RegenerationPollInterval, pollRegeneration, 0);
+	return true;
+}
 
-	case '4':
-		createStepFaultTerrain();
-		break;
+//Upload the heightmap of a new chunked terrain and draw it from now on
+void swapInChunkedTerrain()
+{
+	unsigned int terrainDimension = newChunkQuadtree->getTerrainDimension();
+	glActiveTexture( GL_TEXTURE1 );
+	glBindTexture( GL_TEXTURE_2D, textures[1] );
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, terrainDimension, terrainDimension, 0,
+		GL_RED, GL_FLOAT, newChunkQuadtree->getHeightMap().data() );
+	glActiveTexture( GL_TEXTURE0 );
+
+	chunkQuadtree = newChunkQuadtree;
+	newChunkQuadtree.reset();
+}
 
-	case '5':
-		std::cout << "Sorry this has not been implemented yet" << std::endl;
-		exit(EXIT_SUCCESS);
-		break;
+//Upload the normal map baked for a new terrain
+void swapInNormalMap()
+{
+	unsigned int terrainDimension = newTerrain->getTerrainDimension();
+	glActiveTexture( GL_TEXTURE2 );
+	glBindTexture( GL_TEXTURE_2D, textures[2] );
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, terrainDimension, terrainDimension, 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, newNormalMap.data() );
+	glActiveTexture( GL_TEXTURE0 );
+	glUniform1f( dimension, terrainDimension );
+
+	std::vector<unsigned char>().swap(newNormalMap);
+}
 
-	case '6':
-		std::cout << "Sorry this has not been implemented yet" << std::endl;
-		exit(EXIT_SUCCESS);
-		break;
+//Upload a lightmap. Its rows are two bytes per height, so they are not padded to four bytes.
+void uploadLightmap(unsigned int terrainDimension, const std::vector<unsigned char>& lightmap)
+{
+	glActiveTexture( GL_TEXTURE3 );
+	glBindTexture( GL_TEXTURE_2D, textures[3] );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, terrainDimension, terrainDimension, 0,
+		GL_RG, GL_UNSIGNED_BYTE, lightmap.data() );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	glActiveTexture( GL_TEXTURE0 );
+}
 
-	case '7':
-		createCosineBumpTerrain();
-		break;
+void pollLightmap(int value);
 
-	default:
-		exit(EXIT_SUCCESS);
-		break;
+//Bake the lightmap again after the terrain has been sculpted. Shadows and occlusion reach far across the terrain, so the whole
+//lightmap is baked rather than the changed regions. It is baked from a snapshot on the worker, so sculpting goes on meanwhile.
+void rebakeLightmap()
+{
+	if (lightmapThread.joinable()) {
+		lightmapRebakeWanted = true;
+		return;
+	}
 
+	lightmapRebakeWanted = false;
+	lightmapTerrain = terrain;
+	lightmapBaked = false;
+	TiledHeightMap heights = terrain->getSnapshot();
+	lightmapThread = std::thread([heights] {
+		LightmapBaker::bake(heights, SunDirection.x, SunDirection.y, SunDirection.z, rebakedLightmap);
+		lightmapBaked = true;
+	});
+	glutTimerFunc(RegenerationPollInterval, pollLightmap, 0);
+}
+
+//Upload the re-baked lightmap once the worker is done. It is dropped if a new terrain was swapped in while it baked.
+void pollLightmap(int /*value*/)
+{
+	if (!lightmapBaked) {
+		glutTimerFunc(RegenerationPollInterval, pollLightmap, 0);
+		return;
 	}
-		
 
-	make_triangles();
-	make_texture();
+	lightmapThread.join();
+	bool terrainKept = lightmapTerrain == terrain;
+	if (terrainKept) {
+		uploadLightmap(terrain->getTerrainDimension(), rebakedLightmap);
+		glutPostRedisplay();
+	}
+	lightmapTerrain.reset();
+	std::vector<unsigned char>().swap(rebakedLightmap);
 
+	if (lightmapRebakeWanted && terrainKept) {
+		rebakeLightmap();
+	}
+}
 
-    // Initialize texture objects
-    glGenTextures( 1, textures );
+//Move the background regeneration along. Runs on the GL thread between frames so that drawing never waits for the worker.
+void updateRegeneration()
+{
+	if (regenerationState == WAITING_FOR_BUFFERS) {
+		{
+			std::lock_guard<std::mutex> lock(regenerationMutex);
+			regenerationBufferSet = &terrainBuffers->beginUpload(meshDimension * meshDimension, indices.size());
+			regenerationState = WRITING_BUFFERS;
+		}
+		buffersMapped.notify_one();
+	}
+	else if (regenerationState == READY_TO_SWAP) {
+		regenerationThread.join();
+		swapInNormalMap();
+		uploadLightmap(newTerrain->getTerrainDimension(), newLightmap);
+		std::vector<unsigned char>().swap(newLightmap);
+		if (selectedMesh == 'L') {
+			swapInChunkedTerrain();
+		}
+		else {
+			terrainBuffers->endUpload();
+			regenerationBufferSet = NULL;
+			std::vector<int>().swap(indices);
+		}
+		terrain = newTerrain;
+		terrain->clearDirtyRegions();
+		undoHistory.clear();
+		newTerrain.reset();
+		regenerationState = REGENERATION_IDLE;
+		std::cout << "Terrain ready after " << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - regenerationStart).count() <<
+			" ms" << std::endl;
+		glutPostRedisplay();
+	}
+}
 
-	//Load texture from image file
-	int textureWidth = 655, textureHeight = 491;
-	unsigned char* textureData = readTextureFile("rock.bmp", textureWidth, textureHeight);
+//Check on the background regeneration until the new terrain has been swapped in
+void pollRegeneration(int /*value*/)
+{
+	updateRegeneration();
+	if (regenerationState != REGENERATION_IDLE) {
+		glutTimerFunc(RegenerationPollInterval, pollRegeneration, 0);
+	}
+}
 
-    glBindTexture( GL_TEXTURE_2D, textures[0] );
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, textureWidth, textureHeight, 0,
-		GL_RGB, GL_UNSIGNED_BYTE, textureData );
-    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+//Rewrite the vertices and normal map texels around the heights changed since the last frame and upload just those rows. The
+//normals next to a change depend on it, so each region grows by one vertex. Adaptive meshes keep their triangles until the terrain is regenerated.
+void updateDirtyRegions()
+{
+	if (selectedMesh == 'L' || !terrain || !terrainBuffers->hasMesh()) {
+		return;
+	}
+
+	terrain->takeDirtyRegions(dirtyRegions);
+	unsigned int terrainDimension = terrain->getTerrainDimension();
+	const TiledHeightMap& heightMap = terrain->getHeightMap();
+	std::vector<vec3> rowVertices(terrainDimension), rowNormals(terrainDimension);
+	std::vector<vec2> rowTextureCoordinates(terrainDimension);
+	std::vector<unsigned char> regionNormals;
+
+	glActiveTexture( GL_TEXTURE2 );
+	glBindTexture( GL_TEXTURE_2D, textures[2] );
+	for (unsigned int regionCounter = 0; regionCounter < dirtyRegions.size(); ++regionCounter) {
+		const DirtyRegion& region = dirtyRegions[regionCounter];
+		unsigned int firstRow = region.firstRow > 0 ? region.firstRow - 1 : 0, lastRow = std::min(region.lastRow + 1, terrainDimension - 1);
+		unsigned int firstColumn = region.firstColumn > 0 ? region.firstColumn - 1 : 0, lastColumn = std::min(region.lastColumn + 1, terrainDimension - 1);
+		for (unsigned int row = firstRow; row <= lastRow; ++row) {
+			writeVertexRow(terrainDimension, heightMap, row, firstColumn, lastColumn, rowVertices.data(), rowTextureCoordinates.data(), rowNormals.data());
+			terrainBuffers->updateVertices(row * terrainDimension + firstColumn, lastColumn - firstColumn + 1, rowVertices.data(), rowTextureCoordinates.data(), rowNormals.data());
+		}
+
+		regionNormals.resize(4 * (lastRow - firstRow + 1) * (lastColumn - firstColumn + 1));
+		NormalMapBaker::bake(heightMap, firstRow, firstColumn, lastRow, lastColumn, regionNormals.data());
+		glTexSubImage2D(GL_TEXTURE_2D, 0, firstColumn, firstRow, lastColumn - firstColumn + 1, lastRow - firstRow + 1,
+			GL_RGBA, GL_UNSIGNED_BYTE, regionNormals.data());
+	}
+	glActiveTexture( GL_TEXTURE0 );
+}
+
+//Create the buffers for drawing the whole terrain at once. The terrain is uploaded into them as it is generated.
+void initTriangleBuffers(GLuint program)
+{
+	terrainBuffers = std::shared_ptr<TerrainBuffers>(new TerrainBuffers(program));
+}
 
-    // Create and initialize buffer objects
-    GLuint vbuffer;
-    glGenBuffers(1, &vbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vbuffer);
-	glBufferData(GL_ARRAY_BUFFER, triangles.size()*sizeof(vec3), triangles.data(), GL_STATIC_DRAW);
+//Create the heightmap texture and upload the patch mesh for drawing the terrain in chunks
+void initChunkedTerrain(GLuint program)
+{
+	createPatchIndicesAndVertices(ChunkPatchDimension);
+	std::vector<int> optimizedIndices(indices.size());
+	optimizeVertexCache(optimizedIndices.data());
+	indices.swap(optimizedIndices);
+
+	//The vertex shader reads the heights from a floating point texture that is filled when a terrain is swapped in
+	glGenTextures( 1, &textures[1] );
+	glActiveTexture( GL_TEXTURE1 );
+	glBindTexture( GL_TEXTURE_2D, textures[1] );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	glActiveTexture( GL_TEXTURE0 );
+
+	// Create and initialize buffer objects
+	GLuint vbuffer;
+	glGenBuffers(1, &vbuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vbuffer);
+	glBufferData(GL_ARRAY_BUFFER, patchVertices.size()*sizeof(vec2), patchVertices.data(), GL_STATIC_DRAW);
+
+	GLuint ibuffer;
+	glGenBuffers(1, &ibuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size()*sizeof(int), indices.data(), GL_STATIC_DRAW);
+
+	// Set up the arrays
+	GLuint gPosition = glGetAttribLocation(program, "gPosition");
+	glEnableVertexAttribArray(gPosition);
+	glBindBuffer(GL_ARRAY_BUFFER, vbuffer);
+	glVertexAttribPointer(gPosition, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+	glUniform1i( glGetUniformLocation(program, "heights"), 1 );
+	node = glGetUniformLocation( program, "node" );
+	morph = glGetUniformLocation( program, "morph" );
+	eye = glGetUniformLocation( program, "eye" );
+}
 
-    GLuint tbuffer;
-    glGenBuffers(1, &tbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, tbuffer);
-	glBufferData(GL_ARRAY_BUFFER, tex_coords.size()*sizeof(vec2), tex_coords.data(), GL_STATIC_DRAW);
+// Init Function
+void init(void)
+{
+	getUserSelection();
+
+	if (selectedTerrain == '5' || selectedTerrain == '6') {
+		std::cout << "Sorry this has not been implemented yet" << std::endl;
+		exit(EXIT_SUCCESS);
+	}
 
-    GLuint nbuffer;
-    glGenBuffers(1, &nbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, nbuffer);
-	glBufferData(GL_ARRAY_BUFFER, normals.size()*sizeof(vec3), normals.data(), GL_STATIC_DRAW);
+	//Startup runs as a small task graph. The terrain is generated, meshed and baked on the regeneration worker and the texture
+	//is read on a second worker, while this thread, which owns the GL context, loads the shaders and creates the GL objects.
+	//The texture is uploaded when both it and the shaders are ready, and the terrain is swapped in as soon as it is done, so
+	//the first frame waits for the longest of these rather than all of them.
+	startRegeneration(selectedTerrain);
 
+	//Load texture from image file with its mipmaps, so that distant terrain is not sampled from the full size image
+	TextureImage textureImage;
+	bool textureLoaded = false;
+	std::thread textureThread([&textureImage, &textureLoaded] { textureLoaded = textureImage.load("rock.bmp"); });
 
-    // Load shaders and use the resulting shader program
-    GLuint program = InitShader("vshader.glsl", "fshader.glsl");
+    // Load shaders and use the resulting shader program. Chunked terrains compute their vertices from a heightmap texture.
+    GLuint program = InitShader(selectedMesh == 'L' ? "cdlod_vshader.glsl" : "vshader.glsl", "fshader.glsl");
     glUseProgram(program);
 
 
-    // Set up the arrays
-    GLuint vPosition = glGetAttribLocation(program, "vPosition");
-	glEnableVertexAttribArray(vPosition);
-    glBindBuffer(GL_ARRAY_BUFFER, vbuffer);
-	glVertexAttribPointer(vPosition, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+    // Initialize texture objects
+    glGenTextures( 1, textures );
 
-    GLuint tPosition = glGetAttribLocation(program, "tPosition");
-    glEnableVertexAttribArray(tPosition);
-	glBindBuffer(GL_ARRAY_BUFFER, tbuffer);
-	glVertexAttribPointer(tPosition, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+	textureThread.join();
+    glBindTexture( GL_TEXTURE_2D, textures[0] );
+	if (textureLoaded) {
+		for (unsigned int level = 0; level < textureImage.getLevelCount(); ++level) {
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, textureImage.getLevelWidth(level), textureImage.getLevelHeight(level), 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, textureImage.getLevel(level) );
+		}
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, textureImage.getLevelCount() - 1 );
+	}
+	else {
+		std::cout << "Could not read the texture rock.bmp" << std::endl;
+	}
+    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
+    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
 
-    GLuint nPosition = glGetAttribLocation(program, "nPosition");
-    glEnableVertexAttribArray(nPosition);
-	glBindBuffer(GL_ARRAY_BUFFER, nbuffer);
-	glVertexAttribPointer(nPosition, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+	if (selectedMesh == 'L') {
+		initChunkedTerrain(program);
+	}
+	else {
+		initTriangleBuffers(program);
+	}
 
 
-    theta = glGetUniformLocation( program, "theta" );
-	model_view = glGetUniformLocation( program, "model_view" );
-	zoom = glGetUniformLocation( program, "zoom" );
+	model_view_projection = glGetUniformLocation( program, "model_view_projection" );
+	dimension = glGetUniformLocation( program, "dimension" );
+
+	// The normal map is filled in when a terrain has been generated
+	glGenTextures( 1, &textures[2] );
+	glActiveTexture( GL_TEXTURE2 );
+	glBindTexture( GL_TEXTURE_2D, textures[2] );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	glActiveTexture( GL_TEXTURE0 );
+	glUniform1i( glGetUniformLocation(program, "normals"), 2 );
+	useNormalMap = glGetUniformLocation( program, "useNormalMap" );
+	glUniform1i( useNormalMap, normalMapUsed );
+
+	// So is the lightmap
+	glGenTextures( 1, &textures[3] );
+	glActiveTexture( GL_TEXTURE3 );
+	glBindTexture( GL_TEXTURE_2D, textures[3] );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	glActiveTexture( GL_TEXTURE0 );
+	glUniform1i( glGetUniformLocation(program, "lightmap"), 3 );
+	useLightmap = glGetUniformLocation( program, "useLightmap" );
+	glUniform1i( useLightmap, lightmapUsed );
+	glUniform3fv( glGetUniformLocation(program, "sunDirection"), 1, SunDirection );
 
     // Initialize shader lighting parameters
     vec4 light_ambient( 0.3, 0.3, 0.3, 1.0 );
@@ -409,15 +809,129 @@ void init(void)
 }
 
 
+//Get the rotation of the terrain
+mat4 getModelRotation()
+{
+	return RotateZ(-Theta[2]) * RotateY(Theta[1]) * RotateX(Theta[0]);
+}
+
+//Get the rotation, translation and zoom of the terrain. The eye is at EyeDepth in front of the origin looking along +z.
+mat4 getModelView()
+{
+	return Scale(Zoom[0], Zoom[1], Zoom[2]) * Translate(ModelView[0], ModelView[1], ModelView[2]) * getModelRotation();
+}
+
+//Get the perspective projection. It moves the eye to the origin and turns +z into the -z that the projection looks along.
+mat4 getProjection()
+{
+	return Perspective(FieldOfView, (GLfloat)screenWidth / screenHeight, NearDistance, FarDistance) * Translate(0.0, 0.0, -EyeDepth) * Scale(1.0, 1.0, -1.0);
+}
+
+//Find the eye position in terrain model coordinates by undoing the zoom, translation and rotation of the terrain
+vec3 getEyePosition()
+{
+	vec4 eyePosition = transpose(getModelRotation()) * (vec4(0.0, 0.0, -EyeDepth / Zoom[2], 1.0) - vec4(ModelView[0], ModelView[1], ModelView[2], 0.0));
+	return vec3(eyePosition.x, eyePosition.y, eyePosition.z);
+}
+
+//Find the heightmap row and column under a window position by casting a ray from the eye through it into the terrain
+bool getTerrainPoint(int x, int y, float& row, float& column)
+{
+	//Find the direction through the window position at one unit in front of the eye, then undo the zoom and rotation
+	float tangent = tan(FieldOfView * DegreesToRadians / 2.0);
+	vec4 rayDirection = transpose(getModelRotation()) * vec4((2.0 * x / screenWidth - 1.0) * tangent * screenWidth / screenHeight / Zoom[0],
+		(1.0 - 2.0 * y / screenHeight) * tangent / Zoom[1], 1.0 / Zoom[2], 0.0);
+	vec3 eyePosition = getEyePosition();
+
+	//The terrain intersects rays given in columns, heights and rows
+	float halfDimension = terrain->getTerrainDimension() / 2.0, distance;
+	float origin[3] = { (eyePosition.x + 1.0f) * halfDimension, eyePosition.y, (eyePosition.z + 1.0f) * halfDimension };
+	float direction[3] = { rayDirection.x * halfDimension, rayDirection.y, rayDirection.z * halfDimension };
+	if (!terrain->getRayIntersection(origin, direction, distance)) {
+		return false;
+	}
+
+	column = origin[0] + distance * direction[0];
+	row = origin[2] + distance * direction[2];
+	return true;
+}
+
+//Apply the sculpting brush where the mouse is. The changed heights reach the GPU through the dirty regions of the terrain.
+void sculptAt(int x, int y)
+{
+	float row, column;
+	if (!getTerrainPoint(x, y, row, column)) {
+		return;
+	}
+	if (terrain->applyBrush(sculptingBrush, row, column, changedTiles)) {
+		strokeChangedHeights = true;
+		glutPostRedisplay();
+	}
+}
+
+//Draw the terrain chunks selected for the current eye position
+void drawChunkedTerrain(const mat4& viewTransform)
+{
+	vec3 eyePosition = getEyePosition();
+	glUniform3fv(eye, 1, eyePosition);
+
+	//Skip chunks that are off the screen or hidden behind ridges, using the same transform as the vertex shader
+	chunkCuller.setViewTransform(viewTransform);
+	chunkQuadtree->selectNodes(eyePosition.x, eyePosition.y, eyePosition.z, selectedChunks, &chunkCuller);
+
+	unsigned int quadrantDimension = chunkQuadtree->getPatchDimension() / 2, quadrantIndexCount = 6 * quadrantDimension * quadrantDimension;
+	for (unsigned int chunkCounter = 0; chunkCounter < selectedChunks.size(); ++chunkCounter) {
+		const CdlodSelection& chunk = selectedChunks[chunkCounter];
+		glUniform3f(node, chunk.column, chunk.row, 1 << chunk.lodLevel);
+		glUniform2f(morph, chunkQuadtree->getMorphStart(chunk.lodLevel), chunkQuadtree->getMorphEnd(chunk.lodLevel));
+		if (chunk.quadrant == CdlodQuadtree::ALL_QUADRANTS) {
+			glDrawElements(GL_TRIANGLES, 4 * quadrantIndexCount, GL_UNSIGNED_INT, BUFFER_OFFSET(0));
+		}
+		else {
+			glDrawElements(GL_TRIANGLES, quadrantIndexCount, GL_UNSIGNED_INT, BUFFER_OFFSET(chunk.quadrant * quadrantIndexCount * sizeof(GLuint)));
+		}
+	}
+}
+
 void display(void)
 {
+	frameTimer.startFrame();
+	updateDirtyRegions();
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glUniform3fv(theta, 1, Theta);
-	glUniform4fv(model_view, 1, ModelView);
-	glUniform4fv(zoom, 1, Zoom);
 
-	glDrawArrays(GL_TRIANGLES, 0, triangles.size());
-    glFlush();
+	//The whole transform is built once per frame so that the vertex shader only does one matrix multiply
+	mat4 viewTransform = getProjection() * getModelView();
+	glUniformMatrix4fv(model_view_projection, 1, GL_TRUE, viewTransform);
+
+	if (selectedMesh == 'L') {
+		if (chunkQuadtree) {
+			drawChunkedTerrain(viewTransform);
+		}
+	}
+	else {
+		terrainBuffers->draw();
+	}
+
+	//The time is taken before the swap, which waits for the vertical blank
+	frameTimer.endFrame();
+	glutSwapBuffers();
+}
+
+//Wait for the vertical blank before swapping so that redraws never run faster than the display
+void enableVsync()
+{
+#ifdef _WIN32
+	if (WGLEW_EXT_swap_control) {
+		wglSwapIntervalEXT(1);
+	}
+#elif !defined(__APPLE__)
+	typedef int (*SwapIntervalFunction)(unsigned int);
+	SwapIntervalFunction swapInterval = (SwapIntervalFunction)glXGetProcAddress((const GLubyte*)"glXSwapIntervalMESA");
+	if (swapInterval != NULL) {
+		swapInterval(1);
+	}
+#endif
 }
 
 
@@ -429,9 +943,107 @@ void keyboard(unsigned char keyPressed, int x, int y)
 	switch (keyPressed) {
 
     case 033:              // escape key
+		//Do not wait for a terrain or a lightmap that is still being made
+		if (regenerationThread.joinable()) {
+			regenerationThread.detach();
+		}
+		if (lightmapThread.joinable()) {
+			lightmapThread.detach();
+		}
         exit(EXIT_SUCCESS);
         break;
 
+	//Undo the last sculpting stroke with Ctrl+Z
+	case 26:
+		if (!undoHistory.empty() && terrain) {
+			terrain->restoreSnapshot(undoHistory.back());
+			undoHistory.pop_back();
+			rebakeLightmap();
+		}
+		break;
+
+	//Switch between the baked normal map and the vertex normals
+	case 'n':
+	case 'N':
+		normalMapUsed = !normalMapUsed;
+		glUniform1i(useNormalMap, normalMapUsed);
+		std::cout << (normalMapUsed ? "Lighting with the baked normal map" : "Lighting with the vertex normals") << std::endl;
+		break;
+
+	//Switch the baked ambient occlusion and shadows on and off
+	case 'm':
+	case 'M':
+		lightmapUsed = !lightmapUsed;
+		glUniform1i(useLightmap, lightmapUsed);
+		std::cout << (lightmapUsed ? "Ambient occlusion and shadows on" : "Ambient occlusion and shadows off") << std::endl;
+		break;
+
+	//Save the heights being drawn, with any sculpting
+	case 's':
+	case 'S':
+		if (terrain && HeightMapFile::save(SavedHeightMapName, *terrain)) {
+			std::cout << "Saved the heightmap to " << SavedHeightMapName << std::endl;
+		}
+		else {
+			std::cout << "Cannot save the heightmap to " << SavedHeightMapName << std::endl;
+		}
+		break;
+
+	//Export the mesh of the heights being drawn, with any sculpting
+	case 'e':
+	case 'E':
+		if (terrain && MeshExporter::exportGlb(terrain->getHeightMap(), ExportedMeshName)) {
+			std::cout << "Exported the mesh to " << ExportedMeshName << std::endl;
+		}
+		else {
+			std::cout << "Cannot export the mesh to " << ExportedMeshName << std::endl;
+		}
+		break;
+
+	//Show how long the CPU took over the recent frames
+	case 't':
+	case 'T':
+		std::cout << "Average frame time " << frameTimer.getAverageFrameTime() << " ms, longest " << frameTimer.getMaxFrameTime() <<
+			" ms, " << frameTimer.getRecordedFrames() << " frames drawn" << std::endl;
+		break;
+
+	//Switch the sculpting brush between raising, lowering, smoothing and flattening
+	case 'b':
+	case 'B':
+		sculptingBrush.setMode((TerrainBrush::Mode)((sculptingBrush.getMode() + 1) % 4));
+		if (sculptingBrush.getMode() == TerrainBrush::RAISE) {
+			std::cout << "Brush raises the terrain" << std::endl;
+		}
+		else if (sculptingBrush.getMode() == TerrainBrush::LOWER) {
+			std::cout << "Brush lowers the terrain" << std::endl;
+		}
+		else if (sculptingBrush.getMode() == TerrainBrush::SMOOTH) {
+			std::cout << "Brush smooths the terrain" << std::endl;
+		}
+		else {
+			std::cout << "Brush flattens the terrain" << std::endl;
+		}
+		break;
+
+	//Generate a new terrain of the same type, or of the type with that number, in the background
+	case 'g':
+	case 'G':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '7':
+		if (regenerationState == REGENERATION_IDLE) {
+			++terrainSeed;
+			if (isdigit(keyPressed)) {
+				selectedTerrain = keyPressed;
+			}
+		}
+		if (!startRegeneration(selectedTerrain)) {
+			std::cout << "A terrain is still being generated" << std::endl;
+		}
+		break;
+
 	case 'l':
 		ModelView[0] -= 0.025;
 		break;
@@ -528,11 +1140,51 @@ void keyboard(unsigned char keyPressed, int x, int y)
 		break;
 
 	}
+
+	glutPostRedisplay();
 }
 
-void idle( void )
+void mouse(int button, int state, int x, int y)
 {
-    glutPostRedisplay();
+	//Chunked terrains keep their heights on the GPU, so only the full and adaptive meshes can be sculpted
+	if (button != GLUT_LEFT_BUTTON || selectedMesh == 'L' || !terrain) {
+		return;
+	}
+
+	sculpting = state == GLUT_DOWN;
+	if (sculpting) {
+		if (undoHistory.size() == UndoHistoryLength) {
+			undoHistory.erase(undoHistory.begin());
+		}
+		undoHistory.push_back(terrain->getSnapshot());
+
+		//Flatten to the height where the stroke starts
+		float row, column;
+		if (sculptingBrush.getMode() == TerrainBrush::FLATTEN && getTerrainPoint(x, y, row, column)) {
+			sculptingBrush.setFlattenHeight(terrain->getHeightAt((unsigned int)(row + 0.5), (unsigned int)(column + 0.5)));
+		}
+		strokeChangedHeights = false;
+		sculptAt(x, y);
+	}
+	else if (strokeChangedHeights) {
+		strokeChangedHeights = false;
+		rebakeLightmap();
+	}
+}
+
+void motion(int x, int y)
+{
+	if (sculpting) {
+		sculptAt(x, y);
+	}
+}
+
+//Keep the projection and picking in step with the window size
+void reshape(int width, int height)
+{
+	screenWidth = width;
+	screenHeight = height > 0 ? height : 1;
+	glViewport(0, 0, screenWidth, screenHeight);
 }
 
 
@@ -540,17 +1192,25 @@ void idle( void )
 int main( int argc, char **argv )
 {
     glutInit( &argc, argv );
-    glutInitDisplayMode( GLUT_RGBA );
+
+	//A heightmap file to open can be given after the GLUT options
+	if (argc > 1) {
+		heightMapFileName = argv[1];
+	}
+    glutInitDisplayMode( GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH );
 	glutInitWindowSize(screenWidth, screenHeight);
 
 	glutCreateWindow( "Terrains" );
 
     glewInit();
+    enableVsync();
     init();
 
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
-	glutIdleFunc( idle );
+	glutMouseFunc(mouse);
+	glutMotionFunc(motion);
+	glutReshapeFunc(reshape);
 
     glutMainLoop();
     return 0;